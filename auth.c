@@ -0,0 +1,55 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "auth.h"
+#include "log.h"
+#include "swaylock.h"
+
+static const char *auth_source_names[AUTH_SOURCE_COUNT] = {
+	[AUTH_SOURCE_PASSWORD] = "password",
+	[AUTH_SOURCE_FINGERPRINT] = "fingerprint",
+};
+
+void auth_broker_add_source(struct swaylock_state *state,
+		enum auth_source source, void (*cancel)(void *data), void *data) {
+	struct auth_broker_source *entry = &state->auth.sources[source];
+	entry->registered = true;
+	entry->cancel = cancel;
+	entry->data = data;
+}
+
+void auth_broker_activity(struct swaylock_state *state, enum auth_source source) {
+	state->auth.sources[source].activity = ++state->auth.activity;
+}
+
+void auth_broker_succeeded(struct swaylock_state *state, enum auth_source source) {
+	struct auth_broker *auth = &state->auth;
+	if (auth->done) {
+		return;
+	}
+	auth->done = true;
+	swaylock_log(LOG_DEBUG, "Unlocked by %s", auth_source_names[source]);
+
+	for (int i = 0; i < AUTH_SOURCE_COUNT; ++i) {
+		struct auth_broker_source *other = &auth->sources[i];
+		if (i != (int)source && other->registered && other->cancel) {
+			other->cancel(other->data);
+		}
+	}
+	state->run_display = false;
+}
+
+bool auth_broker_failed(struct swaylock_state *state, enum auth_source source) {
+	struct auth_broker *auth = &state->auth;
+	if (auth->done) {
+		return false;
+	}
+	uint64_t activity = auth->sources[source].activity;
+	for (int i = 0; i < AUTH_SOURCE_COUNT; ++i) {
+		if (auth->sources[i].activity > activity) {
+			swaylock_log(LOG_DEBUG, "Not showing %s failure over newer %s "
+				"status", auth_source_names[source], auth_source_names[i]);
+			return false;
+		}
+	}
+	return true;
+}
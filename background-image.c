@@ -1,8 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "background-image.h"
 #include "cairo.h"
 #include "log.h"
 
+// Number of scaled backgrounds kept; outputs sharing an image and size share
+// a single entry, so this only needs to cover a few distinct outputs
+#define SCALED_BACKGROUND_CACHE_SIZE 4
+
+struct scaled_background {
+	char *path;
+	enum background_mode mode;
+	uint32_t color;
+	int width, height;
+	cairo_surface_t *surface;
+	unsigned long last_used;
+};
+
+static struct scaled_background scaled_backgrounds[SCALED_BACKGROUND_CACHE_SIZE];
+static unsigned long scaled_background_clock = 0;
+
+// On-disk cache of scaled backgrounds, disabled while NULL
+static char *background_cache_dir = NULL;
+
+#define BACKGROUND_CACHE_MAGIC "SWLKBG01"
+// Pixel rows start on a page boundary so they can be mapped directly
+#define BACKGROUND_CACHE_DATA_OFFSET 4096
+
+struct background_cache_header {
+	char magic[8];
+	int64_t mtime_sec, mtime_nsec;
+	int64_t size;
+	int32_t width, height, stride;
+	uint32_t mode, color;
+	uint32_t path_len;
+	// followed by the image path, then the rows at BACKGROUND_CACHE_DATA_OFFSET
+};
+
+struct background_cache_write {
+	char *file;
+	struct background_cache_header header;
+	char *path;
+	cairo_surface_t *surface;
+};
+
+struct background_cache_mapping {
+	void *data;
+	size_t size;
+};
+
+static const cairo_user_data_key_t background_cache_mapping_key;
+
+// A background being scaled on a worker thread, so that outputs are scaled
+// in parallel and none of them blocks the main loop
+struct scaled_background_job {
+	char *path;
+	enum background_mode mode;
+	uint32_t color;
+	int width, height;
+	cairo_surface_t *image;
+	bool use_disk;
+	struct background_cache_header header;
+	void (*ready)(void *data);
+	void *data;
+	struct scaled_background_job *next;
+};
+
+static struct scaled_background_job *scaled_background_jobs = NULL;
+
 enum background_mode parse_background_mode(const char *mode) {
 	if (strcmp(mode, "stretch") == 0) {
 		return BACKGROUND_MODE_STRETCH;
@@ -124,6 +197,444 @@ void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 		assert(0);
 		break;
 	}
+	// Results are cached, so the slower but better filter is affordable
+	cairo_pattern_set_filter(cairo_get_source(cairo), CAIRO_FILTER_BEST);
 	cairo_paint(cairo);
 	cairo_restore(cairo);
 }
+
+static bool mkdir_if_missing(const char *path) {
+	if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		swaylock_log_errno(LOG_ERROR, "Failed to create %s", path);
+		return false;
+	}
+	return true;
+}
+
+bool init_background_cache(void) {
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char *base;
+	if (cache_home && *cache_home) {
+		base = strdup(cache_home);
+	} else if (home && *home) {
+		base = malloc(strlen(home) + strlen("/.cache") + 1);
+		if (base) {
+			sprintf(base, "%s/.cache", home);
+		}
+	} else {
+		swaylock_log(LOG_ERROR, "Neither XDG_CACHE_HOME nor HOME are set, "
+				"not caching images");
+		return false;
+	}
+	if (!base) {
+		swaylock_log(LOG_ERROR, "Allocation failed");
+		return false;
+	}
+
+	background_cache_dir = malloc(strlen(base) + strlen("/swaylock") + 1);
+	if (!background_cache_dir) {
+		swaylock_log(LOG_ERROR, "Allocation failed");
+		free(base);
+		return false;
+	}
+	sprintf(background_cache_dir, "%s/swaylock", base);
+	bool ok = mkdir_if_missing(base) && mkdir_if_missing(background_cache_dir);
+	free(base);
+	if (!ok) {
+		free(background_cache_dir);
+		background_cache_dir = NULL;
+	}
+	return ok;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+	// FNV-1a
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static bool fill_cache_header(struct background_cache_header *header,
+		const char *path, enum background_mode mode, uint32_t color,
+		int buffer_width, int buffer_height) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+	size_t path_len = strlen(path);
+	if (sizeof(*header) + path_len > BACKGROUND_CACHE_DATA_OFFSET) {
+		return false;
+	}
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, BACKGROUND_CACHE_MAGIC, sizeof(header->magic));
+	header->mtime_sec = st.st_mtim.tv_sec;
+	header->mtime_nsec = st.st_mtim.tv_nsec;
+	header->size = st.st_size;
+	header->width = buffer_width;
+	header->height = buffer_height;
+	header->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
+			buffer_width);
+	header->mode = mode;
+	header->color = color;
+	header->path_len = path_len;
+	return true;
+}
+
+// The file name does not depend on the mtime, so a changed image replaces
+// its stale entry instead of adding a new one
+static char *cache_file_name(const struct background_cache_header *header,
+		const char *path) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = hash_bytes(hash, path, header->path_len);
+	hash = hash_bytes(hash, &header->width, sizeof(header->width));
+	hash = hash_bytes(hash, &header->height, sizeof(header->height));
+	hash = hash_bytes(hash, &header->mode, sizeof(header->mode));
+	hash = hash_bytes(hash, &header->color, sizeof(header->color));
+
+	char *file = malloc(strlen(background_cache_dir) + 1 + 16 + strlen(".bg") + 1);
+	if (file) {
+		sprintf(file, "%s/%016" PRIx64 ".bg", background_cache_dir, hash);
+	}
+	return file;
+}
+
+static void unmap_cached_background(void *data) {
+	struct background_cache_mapping *mapping = data;
+	munmap(mapping->data, mapping->size);
+	free(mapping);
+}
+
+static cairo_surface_t *load_cached_background(
+		const struct background_cache_header *expected, const char *path) {
+	char *file = cache_file_name(expected, path);
+	if (!file) {
+		return NULL;
+	}
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+	free(file);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	cairo_surface_t *surface = NULL;
+	struct background_cache_header header;
+	char stored_path[BACKGROUND_CACHE_DATA_OFFSET];
+	if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+			memcmp(&header, expected, sizeof(header)) != 0 ||
+			read(fd, stored_path, header.path_len) != (ssize_t)header.path_len ||
+			memcmp(stored_path, path, header.path_len) != 0) {
+		goto out;
+	}
+
+	struct background_cache_mapping *mapping = malloc(sizeof(*mapping));
+	if (!mapping) {
+		goto out;
+	}
+	mapping->size = (size_t)header.stride * header.height;
+	// Private and writable so that cairo never touches the file, even if it
+	// decides to write to the surface
+	mapping->data = mmap(NULL, mapping->size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, BACKGROUND_CACHE_DATA_OFFSET);
+	if (mapping->data == MAP_FAILED) {
+		free(mapping);
+		goto out;
+	}
+
+	// Reject truncated files, reading past their end would fault
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <
+			(off_t)(BACKGROUND_CACHE_DATA_OFFSET + mapping->size)) {
+		unmap_cached_background(mapping);
+		goto out;
+	}
+
+	surface = cairo_image_surface_create_for_data(mapping->data,
+			CAIRO_FORMAT_ARGB32, header.width, header.height, header.stride);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS ||
+			cairo_surface_set_user_data(surface, &background_cache_mapping_key,
+				mapping, unmap_cached_background) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		unmap_cached_background(mapping);
+		surface = NULL;
+	}
+
+out:
+	close(fd);
+	return surface;
+}
+
+static void free_cache_write(void *data) {
+	struct background_cache_write *cache_write = data;
+	cairo_surface_destroy(cache_write->surface);
+	free(cache_write->file);
+	free(cache_write->path);
+	free(cache_write);
+}
+
+static bool write_all(int fd, const void *data, size_t len) {
+	const char *ptr = data;
+	while (len > 0) {
+		ssize_t n = write(fd, ptr, len);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void store_cached_background_thread(GTask *task, gpointer source_object,
+		gpointer task_data, GCancellable *cancellable) {
+	struct background_cache_write *cache_write = task_data;
+	const struct background_cache_header *header = &cache_write->header;
+
+	char *temp = malloc(strlen(cache_write->file) + strlen(".XXXXXX") + 1);
+	if (!temp) {
+		return;
+	}
+	sprintf(temp, "%s.XXXXXX", cache_write->file);
+	int fd = mkstemp(temp);
+	if (fd < 0) {
+		swaylock_log_errno(LOG_ERROR, "Failed to create %s", temp);
+		free(temp);
+		return;
+	}
+
+	char padding[BACKGROUND_CACHE_DATA_OFFSET] = {0};
+	size_t padding_len = BACKGROUND_CACHE_DATA_OFFSET -
+		sizeof(*header) - header->path_len;
+	bool ok = write_all(fd, header, sizeof(*header)) &&
+		write_all(fd, cache_write->path, header->path_len) &&
+		write_all(fd, padding, padding_len);
+
+	unsigned char *data = cairo_image_surface_get_data(cache_write->surface);
+	int stride = cairo_image_surface_get_stride(cache_write->surface);
+	for (int y = 0; ok && y < header->height; ++y) {
+		ok = write_all(fd, data + (size_t)y * stride, header->stride);
+	}
+
+	if (close(fd) != 0) {
+		ok = false;
+	}
+	if (!ok || rename(temp, cache_write->file) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Failed to write %s", cache_write->file);
+		unlink(temp);
+	} else {
+		swaylock_log(LOG_DEBUG, "Cached background in %s", cache_write->file);
+	}
+	free(temp);
+}
+
+// The surface stays referenced by the write, and is not modified once cached,
+// so it can be read from the worker thread
+static void store_cached_background(const struct background_cache_header *header,
+		const char *path, cairo_surface_t *surface) {
+	struct background_cache_write *cache_write = calloc(1, sizeof(*cache_write));
+	if (!cache_write) {
+		return;
+	}
+	cache_write->header = *header;
+	cache_write->file = cache_file_name(header, path);
+	cache_write->path = strdup(path);
+	cache_write->surface = cairo_surface_reference(surface);
+	if (!cache_write->file || !cache_write->path) {
+		free_cache_write(cache_write);
+		return;
+	}
+
+	GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+	g_task_set_task_data(task, cache_write, free_cache_write);
+	g_task_run_in_thread(task, store_cached_background_thread);
+	g_object_unref(task);
+}
+
+static cairo_surface_t *render_scaled_background(cairo_surface_t *image,
+		enum background_mode mode, uint32_t color,
+		int buffer_width, int buffer_height) {
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			buffer_width, buffer_height);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		swaylock_log(LOG_ERROR, "Failed to create scaled background: %s",
+				cairo_status_to_string(cairo_surface_status(surface)));
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	cairo_t *cairo = cairo_create(surface);
+	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_u32(cairo, color);
+	cairo_paint(cairo);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+	render_background_image(cairo, image, mode, buffer_width, buffer_height);
+	cairo_destroy(cairo);
+	cairo_surface_flush(surface);
+	return surface;
+}
+
+// Takes ownership of surface, and returns it, or NULL on errors
+static cairo_surface_t *cache_scaled_background(const char *path,
+		enum background_mode mode, uint32_t color,
+		int buffer_width, int buffer_height, cairo_surface_t *surface) {
+	char *path_copy = strdup(path);
+	if (!path_copy) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	// Evict the least recently used entry
+	struct scaled_background *slot = &scaled_backgrounds[0];
+	for (size_t i = 1; i < SCALED_BACKGROUND_CACHE_SIZE; ++i) {
+		if (scaled_backgrounds[i].last_used < slot->last_used) {
+			slot = &scaled_backgrounds[i];
+		}
+	}
+	cairo_surface_destroy(slot->surface);
+	free(slot->path);
+	*slot = (struct scaled_background){
+		.path = path_copy,
+		.mode = mode,
+		.color = color,
+		.width = buffer_width,
+		.height = buffer_height,
+		.surface = surface,
+		.last_used = ++scaled_background_clock,
+	};
+	return surface;
+}
+
+static void free_scaled_background_job(void *data) {
+	struct scaled_background_job *job = data;
+	cairo_surface_destroy(job->image);
+	free(job->path);
+	free(job);
+}
+
+// The image is only read, and cairo keeps its reference count atomic, so it
+// can be shared by several of these at once
+static void scale_background_thread(GTask *task, gpointer source_object,
+		gpointer task_data, GCancellable *cancellable) {
+	struct scaled_background_job *job = task_data;
+	g_task_return_pointer(task, render_scaled_background(job->image, job->mode,
+			job->color, job->width, job->height),
+		(GDestroyNotify)cairo_surface_destroy);
+}
+
+static void scale_background_done(GObject *source_object, GAsyncResult *res,
+		gpointer user_data) {
+	struct scaled_background_job *job = g_task_get_task_data(G_TASK(res));
+	cairo_surface_t *surface = g_task_propagate_pointer(G_TASK(res), NULL);
+
+	struct scaled_background_job **link = &scaled_background_jobs;
+	while (*link != job) {
+		link = &(*link)->next;
+	}
+	*link = job->next;
+
+	if (surface) {
+		surface = cache_scaled_background(job->path, job->mode, job->color,
+			job->width, job->height, surface);
+	}
+	if (surface && job->use_disk) {
+		store_cached_background(&job->header, job->path, surface);
+	}
+	job->ready(job->data);
+}
+
+static void start_scaled_background_job(const char *path,
+		cairo_surface_t *image, enum background_mode mode, uint32_t color,
+		int buffer_width, int buffer_height, bool use_disk,
+		const struct background_cache_header *header,
+		void (*ready)(void *data), void *data) {
+	for (struct scaled_background_job *job = scaled_background_jobs; job;
+			job = job->next) {
+		if (strcmp(job->path, path) == 0 && job->mode == mode &&
+				job->color == color && job->width == buffer_width &&
+				job->height == buffer_height) {
+			// Another output of the same size is already waiting for it
+			return;
+		}
+	}
+
+	struct scaled_background_job *job = calloc(1, sizeof(*job));
+	if (!job) {
+		return;
+	}
+	job->path = strdup(path);
+	if (!job->path) {
+		free(job);
+		return;
+	}
+	job->mode = mode;
+	job->color = color;
+	job->width = buffer_width;
+	job->height = buffer_height;
+	job->image = cairo_surface_reference(image);
+	job->use_disk = use_disk;
+	if (use_disk) {
+		job->header = *header;
+	}
+	job->ready = ready;
+	job->data = data;
+	job->next = scaled_background_jobs;
+	scaled_background_jobs = job;
+
+	GTask *task = g_task_new(NULL, NULL, scale_background_done, NULL);
+	g_task_set_task_data(task, job, free_scaled_background_job);
+	g_task_run_in_thread(task, scale_background_thread);
+	g_object_unref(task);
+}
+
+cairo_surface_t *get_scaled_background(const char *path, cairo_surface_t *image,
+		enum background_mode mode, uint32_t color,
+		int buffer_width, int buffer_height,
+		void (*ready)(void *data), void *data) {
+	for (size_t i = 0; i < SCALED_BACKGROUND_CACHE_SIZE; ++i) {
+		struct scaled_background *entry = &scaled_backgrounds[i];
+		if (entry->surface && strcmp(entry->path, path) == 0 &&
+				entry->mode == mode && entry->color == color &&
+				entry->width == buffer_width && entry->height == buffer_height) {
+			entry->last_used = ++scaled_background_clock;
+			return entry->surface;
+		}
+	}
+
+	struct background_cache_header header;
+	bool use_disk = background_cache_dir && fill_cache_header(&header, path,
+			mode, color, buffer_width, buffer_height);
+
+	if (use_disk) {
+		cairo_surface_t *surface = load_cached_background(&header, path);
+		if (surface) {
+			swaylock_log(LOG_DEBUG, "Using cached background for %s", path);
+			return cache_scaled_background(path, mode, color,
+				buffer_width, buffer_height, surface);
+		}
+	}
+	if (image) {
+		start_scaled_background_job(path, image, mode, color,
+			buffer_width, buffer_height, use_disk, &header, ready, data);
+	}
+	return NULL;
+}
+
+void release_scaled_background(cairo_surface_t *surface) {
+	for (size_t i = 0; i < SCALED_BACKGROUND_CACHE_SIZE; ++i) {
+		struct scaled_background *entry = &scaled_backgrounds[i];
+		if (entry->surface == surface) {
+			cairo_surface_destroy(entry->surface);
+			free(entry->path);
+			*entry = (struct scaled_background){0};
+			return;
+		}
+	}
+}
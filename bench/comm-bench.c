@@ -0,0 +1,349 @@
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "comm.h"
+#include "log.h"
+#include "password-buffer.h"
+#include "swaylock.h"
+
+/*
+ * Runs the password check pipeline of comm.c against a fake verifier plugged
+ * into spawn_comm_child in place of the PAM or shadow backend, and checks how
+ * it behaves when the verifier is fast, slow, or crashes. Every scenario runs
+ * in a process of its own, since comm.c keeps a single backend child.
+ */
+
+#define CORRECT_PASSWORD "hunter2"
+#define WRONG_PASSWORD "hunter3"
+
+#define LATENCY_ROUNDS 2000
+#define BURST_REQUESTS 20
+// Time a slow verifier takes per check, and how long the UI waits for it
+#define SLOW_CHECK_MS 300
+#define REPLY_TIMEOUT_MS 100
+// Upper bound for any scenario, past it the scenario is killed and failed
+#define SCENARIO_TIMEOUT_S 30
+
+enum verifier_mode {
+	VERIFIER_FAST,
+	VERIFIER_SLOW,
+	VERIFIER_CRASH, // killed by SIGKILL on its first request
+};
+
+// Set before spawn_comm_child, and inherited by the verifier
+static enum verifier_mode verifier_mode;
+
+// Used by write_comm_request, normally from password.c
+void clear_buffer(char *buf, size_t size) {
+	volatile char *buffer = buf;
+	for (size_t i = 0; i < size; ++i) {
+		buffer[i] = '\0';
+	}
+}
+
+void clear_password_buffer(struct swaylock_password *pw) {
+	clear_buffer(pw->buffer, pw->buffer_len);
+	pw->len = 0;
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (long)(ms % 1000) * 1000000,
+	};
+	while (nanosleep(&ts, &ts) != 0) {
+		// Interrupted, sleep for the rest
+	}
+}
+
+static void run_fake_verifier(void) {
+	for (;;) {
+		char *buf;
+		uint32_t id;
+		ssize_t size = read_comm_request(&id, &buf);
+		if (size < 0) {
+			exit(EXIT_FAILURE);
+		} else if (size == 0) {
+			break;
+		}
+		bool success = strcmp(buf, CORRECT_PASSWORD) == 0;
+		password_buffer_destroy(buf, size);
+
+		switch (verifier_mode) {
+		case VERIFIER_FAST:
+			break;
+		case VERIFIER_SLOW:
+			sleep_ms(SLOW_CHECK_MS);
+			break;
+		case VERIFIER_CRASH:
+			raise(SIGKILL);
+			break;
+		}
+		if (!write_comm_reply(id, success ? COMM_STATUS_SUCCESS :
+				COMM_STATUS_FAILURE, 0, NULL)) {
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static uint32_t send_password(const char *password) {
+	struct swaylock_password pw = {
+		.buffer_len = 64,
+		.buffer = password_buffer_create(64),
+	};
+	if (!pw.buffer) {
+		return 0;
+	}
+	pw.len = strlen(password);
+	memcpy(pw.buffer, password, pw.len + 1);
+	uint32_t id = write_comm_request(&pw);
+	password_buffer_destroy(pw.buffer, pw.buffer_len);
+	return id;
+}
+
+// Returns 1 with the next reply, 0 on timeout, or -1 if the reply pipe
+// failed, with the poll events in *revents
+static int wait_reply(int timeout_ms, struct comm_reply *reply,
+		short *revents) {
+	struct pollfd pfd = {get_comm_reply_fd(), POLLIN, 0};
+	int ret = poll(&pfd, 1, timeout_ms);
+	*revents = pfd.revents;
+	if (ret == 0) {
+		return 0;
+	} else if (ret < 0) {
+		return -1;
+	}
+	// Like comm_in, replies still queued are read before a hangup counts
+	return read_comm_reply(reply) ? 1 : -1;
+}
+
+static bool expect_reply(struct comm_reply *reply, uint32_t id,
+		enum comm_status status) {
+	short revents;
+	int ret = wait_reply(SCENARIO_TIMEOUT_S * 1000, reply, &revents);
+	if (ret != 1) {
+		fprintf(stderr, "no reply for request %u\n", id);
+		return false;
+	}
+	if (reply->id != id || reply->status != status) {
+		fprintf(stderr, "request %u got reply %u with status %d, not %d\n",
+			id, reply->id, reply->status, status);
+		return false;
+	}
+	return true;
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Sequential checks, as when every attempt is typed out and waited for
+static bool scenario_latency(void) {
+	verifier_mode = VERIFIER_FAST;
+	if (!spawn_comm_child(run_fake_verifier)) {
+		return false;
+	}
+
+	static uint64_t samples[LATENCY_ROUNDS];
+	for (int i = 0; i < LATENCY_ROUNDS; ++i) {
+		bool correct = i % 2 == 0;
+		uint64_t start = now_ns();
+		uint32_t id = send_password(correct ? CORRECT_PASSWORD : WRONG_PASSWORD);
+		struct comm_reply reply;
+		if (!id || !expect_reply(&reply, id, correct ?
+				COMM_STATUS_SUCCESS : COMM_STATUS_FAILURE)) {
+			return false;
+		}
+		samples[i] = now_ns() - start;
+	}
+
+	qsort(samples, LATENCY_ROUNDS, sizeof(samples[0]), compare_u64);
+	printf("latency: %d request->reply round trips, p50 %.1f us, "
+		"p90 %.1f us, p99 %.1f us, max %.1f us\n", LATENCY_ROUNDS,
+		samples[LATENCY_ROUNDS / 2] / 1e3,
+		samples[LATENCY_ROUNDS * 9 / 10] / 1e3,
+		samples[LATENCY_ROUNDS * 99 / 100] / 1e3,
+		samples[LATENCY_ROUNDS - 1] / 1e3);
+	return true;
+}
+
+// Enter pressed repeatedly while a slow check runs: every request must get
+// exactly one reply, only the newest must be checked after the running one,
+// and the correct password sent last must succeed
+static bool scenario_burst(void) {
+	verifier_mode = VERIFIER_SLOW;
+	if (!spawn_comm_child(run_fake_verifier)) {
+		return false;
+	}
+
+	uint32_t ids[BURST_REQUESTS];
+	uint64_t start = now_ns();
+	for (int i = 0; i < BURST_REQUESTS; ++i) {
+		bool last = i == BURST_REQUESTS - 1;
+		ids[i] = send_password(last ? CORRECT_PASSWORD : WRONG_PASSWORD);
+		if (!ids[i]) {
+			return false;
+		}
+	}
+
+	bool answered[BURST_REQUESTS] = {0};
+	int remaining = BURST_REQUESTS, checked = 0;
+	while (remaining > 0) {
+		struct comm_reply reply;
+		short revents;
+		if (wait_reply(SCENARIO_TIMEOUT_S * 1000, &reply, &revents) != 1) {
+			fprintf(stderr, "%d burst requests were never answered\n",
+				remaining);
+			return false;
+		}
+		int i = 0;
+		while (i < BURST_REQUESTS && ids[i] != reply.id) {
+			++i;
+		}
+		if (i == BURST_REQUESTS || answered[i]) {
+			fprintf(stderr, "unexpected reply %u\n", reply.id);
+			return false;
+		}
+		answered[i] = true;
+		--remaining;
+		if (reply.status != COMM_STATUS_CANCELLED) {
+			++checked;
+		}
+		bool last = i == BURST_REQUESTS - 1;
+		if (last && reply.status != COMM_STATUS_SUCCESS) {
+			fprintf(stderr, "newest burst request got status %d\n",
+				reply.status);
+			return false;
+		}
+	}
+	double ms = (now_ns() - start) / 1e6;
+
+	// The first request may already be running when the rest arrive
+	if (checked > 2) {
+		fprintf(stderr, "%d of %d burst requests were checked\n", checked,
+			BURST_REQUESTS);
+		return false;
+	}
+	printf("burst: %d requests, %d checked, all answered in %.1f ms\n",
+		BURST_REQUESTS, checked, ms);
+	return true;
+}
+
+// A check outlasting the UI timeout must still be answered, and the requests
+// made meanwhile must be answered after it
+static bool scenario_slow_backend(void) {
+	verifier_mode = VERIFIER_SLOW;
+	if (!spawn_comm_child(run_fake_verifier)) {
+		return false;
+	}
+
+	uint64_t start = now_ns();
+	uint32_t slow_id = send_password(WRONG_PASSWORD);
+	struct comm_reply reply;
+	short revents;
+	if (!slow_id || wait_reply(REPLY_TIMEOUT_MS, &reply, &revents) != 0) {
+		fprintf(stderr, "slow check did not time out\n");
+		return false;
+	}
+
+	// A cancelled request queued behind the running one, then a retry
+	uint32_t cancelled_id = send_password(WRONG_PASSWORD);
+	if (!cancelled_id || !write_comm_cancel(cancelled_id)) {
+		return false;
+	}
+	uint32_t retry_id = send_password(CORRECT_PASSWORD);
+	if (!retry_id) {
+		return false;
+	}
+
+	if (!expect_reply(&reply, slow_id, COMM_STATUS_FAILURE)) {
+		return false;
+	}
+	double slow_ms = (now_ns() - start) / 1e6;
+	if (!expect_reply(&reply, cancelled_id, COMM_STATUS_CANCELLED) ||
+			!expect_reply(&reply, retry_id, COMM_STATUS_SUCCESS)) {
+		return false;
+	}
+	double retry_ms = (now_ns() - start) / 1e6;
+	printf("slow backend: timed out after %d ms, answered after %.1f ms, "
+		"retry answered after %.1f ms\n", REPLY_TIMEOUT_MS, slow_ms,
+		retry_ms);
+	return true;
+}
+
+// A verifier dying mid-check must show up as a hangup of the reply pipe,
+// which comm_in treats as fatal, and later requests must fail cleanly
+static bool scenario_crash(void) {
+	verifier_mode = VERIFIER_CRASH;
+	if (!spawn_comm_child(run_fake_verifier)) {
+		return false;
+	}
+	// The failures below are expected
+	swaylock_log_init(LOG_SILENT);
+
+	uint64_t start = now_ns();
+	uint32_t id = send_password(CORRECT_PASSWORD);
+	struct comm_reply reply;
+	short revents;
+	if (!id || wait_reply(SCENARIO_TIMEOUT_S * 1000, &reply, &revents) != -1 ||
+			!(revents & (POLLHUP | POLLERR))) {
+		fprintf(stderr, "crash was not seen as a hangup\n");
+		return false;
+	}
+	double ms = (now_ns() - start) / 1e6;
+
+	// Writes to the dead child fail with EPIPE instead of killing us
+	signal(SIGPIPE, SIG_IGN);
+	if (send_password(CORRECT_PASSWORD) != 0) {
+		fprintf(stderr, "request to a crashed backend succeeded\n");
+		return false;
+	}
+	printf("crash: hangup seen after %.1f ms, later requests fail\n", ms);
+	return true;
+}
+
+static bool run_scenario(const char *name, bool (*scenario)(void)) {
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return false;
+	} else if (pid == 0) {
+		alarm(SCENARIO_TIMEOUT_S);
+		exit(scenario() ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0) {
+		perror("waitpid");
+		return false;
+	}
+	bool ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+	if (!ok) {
+		printf("%s: FAILED\n", name);
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	swaylock_log_init(LOG_ERROR);
+	bool ok = run_scenario("latency", scenario_latency);
+	ok = run_scenario("burst", scenario_burst) && ok;
+	ok = run_scenario("slow backend", scenario_slow_backend) && ok;
+	ok = run_scenario("crash", scenario_crash) && ok;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,127 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <wayland-client.h>
+#include "mock-wayland.h"
+
+// Frame callbacks pending at once, one per surface and subsurface
+#define MAX_PENDING_FRAMES 64
+
+struct mock_proxy {
+	const struct wl_interface *interface;
+	uint32_t version;
+	void (**listener)(void);
+	void *data;
+	struct mock_proxy *prev, *next;
+};
+
+static struct mock_proxy proxies = {
+	.prev = &proxies,
+	.next = &proxies,
+};
+static unsigned long request_count = 0;
+
+static struct mock_proxy *proxy_create(const struct wl_interface *interface,
+		uint32_t version) {
+	struct mock_proxy *proxy = calloc(1, sizeof(*proxy));
+	if (!proxy) {
+		abort();
+	}
+	proxy->interface = interface;
+	proxy->version = version;
+	proxy->prev = proxies.prev;
+	proxy->next = &proxies;
+	proxies.prev->next = proxy;
+	proxies.prev = proxy;
+	return proxy;
+}
+
+struct wl_proxy *mock_proxy_create(const struct wl_interface *interface) {
+	return (struct wl_proxy *)proxy_create(interface, 1);
+}
+
+struct wl_proxy *wl_proxy_marshal_flags(struct wl_proxy *proxy, uint32_t opcode,
+		const struct wl_interface *interface, uint32_t version,
+		uint32_t flags, ...) {
+	++request_count;
+	struct mock_proxy *created = NULL;
+	if (interface) {
+		created = proxy_create(interface, version);
+	}
+	if (flags & WL_MARSHAL_FLAG_DESTROY) {
+		wl_proxy_destroy(proxy);
+	}
+	return (struct wl_proxy *)created;
+}
+
+int wl_proxy_add_listener(struct wl_proxy *proxy,
+		void (**implementation)(void), void *data) {
+	struct mock_proxy *mock = (struct mock_proxy *)proxy;
+	if (mock->listener) {
+		return -1;
+	}
+	mock->listener = implementation;
+	mock->data = data;
+	return 0;
+}
+
+const void *wl_proxy_get_listener(struct wl_proxy *proxy) {
+	return ((struct mock_proxy *)proxy)->listener;
+}
+
+void wl_proxy_destroy(struct wl_proxy *proxy) {
+	struct mock_proxy *mock = (struct mock_proxy *)proxy;
+	mock->prev->next = mock->next;
+	mock->next->prev = mock->prev;
+	free(mock);
+}
+
+uint32_t wl_proxy_get_version(struct wl_proxy *proxy) {
+	return ((struct mock_proxy *)proxy)->version;
+}
+
+uint32_t wl_proxy_get_id(struct wl_proxy *proxy) {
+	return 0;
+}
+
+void wl_proxy_set_user_data(struct wl_proxy *proxy, void *user_data) {
+	((struct mock_proxy *)proxy)->data = user_data;
+}
+
+void *wl_proxy_get_user_data(struct wl_proxy *proxy) {
+	return ((struct mock_proxy *)proxy)->data;
+}
+
+void mock_release_buffers(void) {
+	for (struct mock_proxy *proxy = proxies.next; proxy != &proxies;
+			proxy = proxy->next) {
+		if (proxy->interface == &wl_buffer_interface && proxy->listener) {
+			const struct wl_buffer_listener *listener =
+				(const struct wl_buffer_listener *)proxy->listener;
+			listener->release(proxy->data, (struct wl_buffer *)proxy);
+		}
+	}
+}
+
+void mock_done_frames(uint32_t time) {
+	// The done handlers destroy their callback and may render again, so the
+	// pending ones are collected first
+	struct mock_proxy *pending[MAX_PENDING_FRAMES];
+	size_t count = 0;
+	for (struct mock_proxy *proxy = proxies.next;
+			proxy != &proxies && count < MAX_PENDING_FRAMES;
+			proxy = proxy->next) {
+		if (proxy->interface == &wl_callback_interface && proxy->listener) {
+			pending[count++] = proxy;
+		}
+	}
+	for (size_t i = 0; i < count; ++i) {
+		const struct wl_callback_listener *listener =
+			(const struct wl_callback_listener *)pending[i]->listener;
+		listener->done(pending[i]->data, (struct wl_callback *)pending[i],
+			time);
+	}
+}
+
+unsigned long mock_request_count(void) {
+	return request_count;
+}
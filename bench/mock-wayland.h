@@ -0,0 +1,36 @@
+#ifndef _SWAYLOCK_MOCK_WAYLAND_H
+#define _SWAYLOCK_MOCK_WAYLAND_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+/**
+ * Stand-in for the proxy layer of libwayland-client, linked into benchmarks
+ * in its place so that render.c and pool-buffer.c run without a compositor.
+ * Requests are counted and dropped; requests that create objects return new
+ * mock proxies, whose listeners are kept so that compositor events can be
+ * emulated. wl_shm buffers are still real memfd mappings.
+ */
+
+/**
+ * Returns a proxy standing for a global or an object created elsewhere.
+ */
+struct wl_proxy *mock_proxy_create(const struct wl_interface *interface);
+
+/**
+ * Sends wl_buffer.release for every buffer, as a compositor that is done
+ * with all of them would.
+ */
+void mock_release_buffers(void);
+
+/**
+ * Sends wl_callback.done for every pending frame callback.
+ */
+void mock_done_frames(uint32_t time);
+
+/**
+ * Returns the number of requests sent so far.
+ */
+unsigned long mock_request_count(void);
+
+#endif
@@ -0,0 +1,371 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+#include "background-image.h"
+#include "cairo.h"
+#include "log.h"
+#include "mock-wayland.h"
+#include "pool-buffer.h"
+#include "swaylock.h"
+
+/*
+ * Draws indicators, fingerprint statuses and backgrounds the way render.c
+ * does for a real output, against the mock proxy layer in mock-wayland.c, and
+ * prints the cost per frame. Indicators are swept over every auth_state and
+ * input_state pair, backgrounds over every background_mode, both at several
+ * scales. Between frames the buffers are released and frame callbacks are
+ * done, as a compositor keeping up would.
+ */
+
+// Frames drawn per case; backgrounds are scaled with CAIRO_FILTER_BEST
+#define INDICATOR_FRAMES 200
+#define FINGERPRINT_FRAMES 200
+#define BACKGROUND_FRAMES 5
+
+// Exit status for meson to report the benchmark as skipped
+#define EXIT_SKIP 77
+
+#ifdef __GLIBC__
+// Counts the heap allocations of the whole process, cairo and pixman's
+// included. Only the glibc entry points are wrapped, which is enough for
+// comparing frames with each other.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_ulong allocation_count = 0;
+
+void *malloc(size_t size) {
+	atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+static const char *auth_state_names[] = {
+	[AUTH_STATE_IDLE] = "idle",
+	[AUTH_STATE_VALIDATING] = "validating",
+	[AUTH_STATE_INVALID] = "invalid",
+	[AUTH_STATE_FINGERPRINT] = "fingerprint",
+};
+
+static const char *input_state_names[] = {
+	[INPUT_STATE_IDLE] = "idle",
+	[INPUT_STATE_CLEAR] = "clear",
+	[INPUT_STATE_LETTER] = "letter",
+	[INPUT_STATE_BACKSPACE] = "backspace",
+	[INPUT_STATE_NEUTRAL] = "neutral",
+};
+
+static const char *background_mode_names[] = {
+	[BACKGROUND_MODE_STRETCH] = "stretch",
+	[BACKGROUND_MODE_FILL] = "fill",
+	[BACKGROUND_MODE_FIT] = "fit",
+	[BACKGROUND_MODE_CENTER] = "center",
+	[BACKGROUND_MODE_TILE] = "tile",
+	[BACKGROUND_MODE_SOLID_COLOR] = "solid_color",
+};
+
+static char fingerprint_msg[] = "Scan your finger";
+static char fingerprint_driver_msg[] = "Place your finger on the reader";
+
+static struct swaylock_state state;
+static struct swaylock_surface surface;
+
+struct counters {
+	uint64_t ns;
+	unsigned long allocations;
+	unsigned long requests;
+};
+
+static struct counters read_counters(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	struct counters counters = {
+		.ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+		.requests = mock_request_count(),
+	};
+#ifdef __GLIBC__
+	counters.allocations = atomic_load_explicit(&allocation_count,
+		memory_order_relaxed);
+#endif
+	return counters;
+}
+
+static void add_since(struct counters *total, const struct counters *start) {
+	struct counters end = read_counters();
+	total->ns += end.ns - start->ns;
+	total->allocations += end.allocations - start->allocations;
+	total->requests += end.requests - start->requests;
+}
+
+static void print_result(const char *name, const struct counters *total,
+		int frames) {
+	double ms = total->ns / 1e6 / frames;
+	printf("%-56s %10.1f frames/s %9.3f ms/frame", name, 1000 / ms, ms);
+#ifdef __GLIBC__
+	printf(" %8.1f allocs/frame", (double)total->allocations / frames);
+#endif
+	printf(" %6.1f requests/frame\n", (double)total->requests / frames);
+}
+
+// Render callbacks into main.c, which the benchmark does not need
+void damage_surfaces(struct swaylock_state *state, uint32_t damage) {
+}
+
+void decode_image(struct swaylock_state *state, struct swaylock_image *image) {
+}
+
+static void set_default_colors(struct swaylock_colors *colors) {
+	colors->background = 0xFFFFFFFF;
+	colors->bs_highlight = 0xDB3300FF;
+	colors->key_highlight = 0x33DB00FF;
+	colors->caps_lock_bs_highlight = 0xDB3300FF;
+	colors->caps_lock_key_highlight = 0x33DB00FF;
+	colors->separator = 0x000000FF;
+	colors->layout_background = 0x000000C0;
+	colors->layout_border = 0x00000000;
+	colors->layout_text = 0xFFFFFFFF;
+	colors->inside = (struct swaylock_colorset){
+		.input = 0x000000C0,
+		.cleared = 0xE5A445C0,
+		.caps_lock = 0x000000C0,
+		.verifying = 0x0072FFC0,
+		.wrong = 0xFA0000C0,
+	};
+	colors->line = (struct swaylock_colorset){
+		.input = 0x000000FF,
+		.cleared = 0x000000FF,
+		.caps_lock = 0x000000FF,
+		.verifying = 0x000000FF,
+		.wrong = 0x000000FF,
+	};
+	colors->ring = (struct swaylock_colorset){
+		.input = 0x337D00FF,
+		.cleared = 0xE5A445FF,
+		.caps_lock = 0xE5A445FF,
+		.verifying = 0x3300FFFF,
+		.wrong = 0x7D3300FF,
+	};
+	colors->text = (struct swaylock_colorset){
+		.input = 0xE5A445FF,
+		.cleared = 0x000000FF,
+		.caps_lock = 0xE5A445FF,
+		.verifying = 0x000000FF,
+		.wrong = 0x000000FF,
+	};
+}
+
+static bool init_state(void) {
+	wl_list_init(&state.surfaces);
+	wl_list_init(&state.images);
+	state.shm = (struct wl_shm *)mock_proxy_create(&wl_shm_interface);
+	set_default_colors(&state.args.colors);
+	state.args.mode = BACKGROUND_MODE_FILL;
+	state.args.show_indicator = true;
+	state.args.indicator_idle_visible = true;
+	state.args.show_failed_attempts = true;
+	state.args.show_keyboard_layout = true;
+	state.failed_attempts = 3;
+	state.fingerprint_msg = fingerprint_msg;
+	state.fingerprint_driver_msg = fingerprint_driver_msg;
+
+	// Two layouts, so that the layout box is drawn too
+	state.xkb.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (!state.xkb.context) {
+		return false;
+	}
+	struct xkb_rule_names names = {
+		.layout = "us,de",
+	};
+	state.xkb.keymap = xkb_keymap_new_from_names(state.xkb.context, &names,
+		XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!state.xkb.keymap) {
+		return false;
+	}
+	state.xkb.state = xkb_state_new(state.xkb.keymap);
+	if (!state.xkb.state) {
+		return false;
+	}
+
+	surface.state = &state;
+	surface.surface = (struct wl_surface *)mock_proxy_create(&wl_surface_interface);
+	surface.child = (struct wl_surface *)mock_proxy_create(&wl_surface_interface);
+	surface.subsurface =
+		(struct wl_subsurface *)mock_proxy_create(&wl_subsurface_interface);
+	surface.fingerprint_status =
+		(struct wl_surface *)mock_proxy_create(&wl_surface_interface);
+	surface.fingerprint_subsurface =
+		(struct wl_subsurface *)mock_proxy_create(&wl_subsurface_interface);
+	surface.created = true;
+	surface.width = 1920;
+	surface.height = 1080;
+	surface.subpixel = WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB;
+	wl_list_insert(&state.surfaces, &surface.link);
+	return true;
+}
+
+static void set_surface_scale(int32_t scale) {
+	surface.scale = scale;
+	// Keeps render from repainting the background, which is measured apart
+	surface.last_buffer_width = surface.width * scale;
+	surface.last_buffer_height = surface.height * scale;
+}
+
+// Renders frames through render(), with only the given damage
+static void run_frames(uint32_t damage, int frames, struct counters *total) {
+	for (int i = 0; i < frames; ++i) {
+		// Keypresses move the highlight somewhere else every time
+		state.highlight_start = (i * 397) % 2048;
+		surface.dirty = damage;
+		struct counters start = read_counters();
+		render(&surface);
+		add_since(total, &start);
+		mock_release_buffers();
+		mock_done_frames(i);
+	}
+}
+
+static void bench_indicator(int32_t scale, uint32_t radius, char *font) {
+	set_surface_scale(scale);
+	state.args.radius = radius;
+	state.args.thickness = radius / 5;
+	state.args.font = font;
+	for (size_t auth = 0; auth < sizeof(auth_state_names) /
+			sizeof(auth_state_names[0]); ++auth) {
+		for (size_t input = 0; input < sizeof(input_state_names) /
+				sizeof(input_state_names[0]); ++input) {
+			state.auth_state = auth;
+			state.input_state = input;
+			struct counters total = {0};
+			run_frames(DAMAGE_INDICATOR, INDICATOR_FRAMES, &total);
+
+			char name[128];
+			snprintf(name, sizeof(name), "indicator %dx r%u %s %s/%s",
+				scale, radius, font, auth_state_names[auth],
+				input_state_names[input]);
+			print_result(name, &total, INDICATOR_FRAMES);
+		}
+	}
+}
+
+static void bench_fingerprint_status(int32_t scale, char *font) {
+	set_surface_scale(scale);
+	state.args.radius = 50;
+	state.args.font = font;
+	struct counters total = {0};
+	run_frames(DAMAGE_FINGERPRINT_STATUS, FINGERPRINT_FRAMES, &total);
+
+	char name[128];
+	snprintf(name, sizeof(name), "fingerprint-status %dx %s", scale, font);
+	print_result(name, &total, FINGERPRINT_FRAMES);
+}
+
+// An opaque photo-like image, smooth with some hard edges
+static cairo_surface_t *create_image(int width, int height) {
+	cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+		width, height);
+	cairo_t *cairo = cairo_create(image);
+	cairo_pattern_t *gradient = cairo_pattern_create_linear(0, 0, width, height);
+	cairo_pattern_add_color_stop_rgb(gradient, 0, 0.1, 0.2, 0.5);
+	cairo_pattern_add_color_stop_rgb(gradient, 0.5, 0.9, 0.5, 0.2);
+	cairo_pattern_add_color_stop_rgb(gradient, 1, 0.2, 0.6, 0.3);
+	cairo_set_source(cairo, gradient);
+	cairo_paint(cairo);
+	cairo_pattern_destroy(gradient);
+	cairo_set_source_rgba(cairo, 1, 1, 1, 0.5);
+	for (int i = 0; i < 16; ++i) {
+		cairo_arc(cairo, width * (i % 4 + 0.5) / 4, height * (i / 4 + 0.5) / 4,
+			height / 12.0, 0, 6.283185307179586);
+		cairo_fill(cairo);
+	}
+	cairo_destroy(cairo);
+	cairo_surface_flush(image);
+	return image;
+}
+
+static void bench_background(cairo_surface_t *image, int32_t scale) {
+	int image_width = cairo_image_surface_get_width(image);
+	int image_height = cairo_image_surface_get_height(image);
+	int buffer_width = surface.width * scale;
+	int buffer_height = surface.height * scale;
+	struct pool_buffer buffers[2] = {0};
+	for (size_t mode = 0; mode < sizeof(background_mode_names) /
+			sizeof(background_mode_names[0]); ++mode) {
+		struct counters total = {0};
+		for (int i = 0; i < BACKGROUND_FRAMES; ++i) {
+			struct counters start = read_counters();
+			struct pool_buffer *buffer = get_next_buffer(state.shm, NULL,
+				buffers, buffer_width, buffer_height);
+			if (!buffer) {
+				fprintf(stderr, "Failed to create a background buffer\n");
+				exit(EXIT_FAILURE);
+			}
+			cairo_t *cairo = buffer->cairo;
+			cairo_save(cairo);
+			cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+			cairo_set_source_u32(cairo, state.args.colors.background);
+			cairo_paint(cairo);
+			cairo_restore(cairo);
+			if (mode != BACKGROUND_MODE_SOLID_COLOR) {
+				render_background_image(cairo, image, mode,
+					buffer_width, buffer_height);
+			}
+			cairo_surface_flush(buffer->surface);
+			add_since(&total, &start);
+			mock_release_buffers();
+		}
+
+		char name[128];
+		snprintf(name, sizeof(name), "background %dx%d on %dx%d %s",
+			image_width, image_height, buffer_width, buffer_height,
+			background_mode_names[mode]);
+		print_result(name, &total, BACKGROUND_FRAMES);
+	}
+	destroy_buffer(&buffers[0]);
+	destroy_buffer(&buffers[1]);
+}
+
+int main(int argc, char **argv) {
+	swaylock_log_init(LOG_ERROR);
+	if (!init_state()) {
+		fprintf(stderr, "No keymap, xkeyboard-config is needed\n");
+		return EXIT_SKIP;
+	}
+
+	char *fonts[] = {"sans-serif", "monospace"};
+	int32_t scales[] = {1, 2, 3};
+	uint32_t radii[] = {50, 100};
+	for (size_t f = 0; f < sizeof(fonts) / sizeof(fonts[0]); ++f) {
+		for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); ++s) {
+			for (size_t r = 0; r < sizeof(radii) / sizeof(radii[0]); ++r) {
+				bench_indicator(scales[s], radii[r], fonts[f]);
+			}
+			bench_fingerprint_status(scales[s], fonts[f]);
+		}
+	}
+
+	int image_sizes[][2] = {{1920, 1080}, {3840, 2160}};
+	for (size_t i = 0; i < sizeof(image_sizes) / sizeof(image_sizes[0]); ++i) {
+		cairo_surface_t *image = create_image(image_sizes[i][0],
+			image_sizes[i][1]);
+		for (int32_t scale = 1; scale <= 2; ++scale) {
+			bench_background(image, scale);
+		}
+		cairo_surface_destroy(image);
+	}
+	return EXIT_SUCCESS;
+}
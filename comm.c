@@ -1,5 +1,13 @@
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS and madvise
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include "comm.h"
@@ -7,46 +15,279 @@
 #include "swaylock.h"
 #include "password-buffer.h"
 
+/*
+ * Requests go from the UI to the backend child as a comm_request_header. The
+ * len bytes of NUL-terminated password of a COMM_REQUEST_AUTH are not sent
+ * through the pipe, but written to a shared password slot beforehand, so they
+ * never sit in kernel pipe buffers. Every auth request is eventually
+ * answered by exactly one comm_reply_header with the request's id, followed
+ * by message_len bytes of error message.
+ *
+ * The child only authenticates the newest queued request. Auth requests that
+ * were superseded by a later one, or cancelled, before the child got to them
+ * are answered with COMM_STATUS_CANCELLED.
+ */
+
+enum comm_request_type {
+	COMM_REQUEST_AUTH = 1,
+	COMM_REQUEST_CANCEL = 2,
+};
+
+struct comm_request_header {
+	uint32_t type; // enum comm_request_type
+	uint32_t id;
+	uint32_t len;
+};
+
+struct comm_reply_header {
+	uint32_t id;
+	int32_t status; // enum comm_status
+	int32_t retry_after_ms;
+	uint32_t message_len;
+};
+
+// A locked, shared page holding the password of the newest request. seq is
+// odd while it is written, so readers can tell torn copies and replaced
+// passwords apart from the one they were notified of.
+struct comm_password_slot {
+	atomic_uint seq;
+	uint32_t id;
+	uint32_t len;
+	size_t capacity;
+	char buffer[];
+};
+
 static int comm[2][2] = {{-1, -1}, {-1, -1}};
+static struct comm_password_slot *comm_slot = NULL;
+
+static uint32_t last_request_id = 0;
+
+int comm_read_full(int fd, void *buf, size_t size) {
+	size_t offs = 0;
+	while (offs < size) {
+		ssize_t amt = read(fd, (char *)buf + offs, size - offs);
+		if (amt == 0 && offs == 0) {
+			return 0;
+		} else if (amt <= 0) {
+			return -1;
+		}
+		offs += (size_t)amt;
+	}
+	return 1;
+}
 
-ssize_t read_comm_request(char **buf_ptr) {
-	size_t size;
-	ssize_t amt;
-	amt = read(comm[0][0], &size, sizeof(size));
-	if (amt == 0) {
+bool comm_write_full(int fd, const void *buf, size_t size) {
+	size_t offs = 0;
+	while (offs < size) {
+		ssize_t amt = write(fd, (const char *)buf + offs, size - offs);
+		if (amt < 0) {
+			return false;
+		}
+		offs += (size_t)amt;
+	}
+	return true;
+}
+
+struct comm_password_slot *comm_password_slot_create(void) {
+	size_t size = sysconf(_SC_PAGESIZE);
+	struct comm_password_slot *slot = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (slot == MAP_FAILED) {
+		swaylock_log_errno(LOG_ERROR, "failed to map password slot");
+		return NULL;
+	}
+	if (mlock(slot, size) != 0) {
+		swaylock_log_errno(LOG_ERROR, "Unable to mlock() password slot");
+	}
+#ifdef MADV_DONTDUMP
+	madvise(slot, size, MADV_DONTDUMP);
+#endif
+	atomic_init(&slot->seq, 0);
+	slot->capacity = size - offsetof(struct comm_password_slot, buffer);
+	return slot;
+}
+
+bool comm_password_slot_write(struct comm_password_slot *slot, uint32_t id,
+		const char *buf, size_t len) {
+	if (len > slot->capacity) {
+		swaylock_log(LOG_ERROR, "password does not fit the password slot");
+		return false;
+	}
+	unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	slot->id = id;
+	slot->len = len;
+	memcpy(slot->buffer, buf, len);
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+	return true;
+}
+
+bool comm_password_slot_read(struct comm_password_slot *slot, uint32_t id,
+		char *buf, size_t len) {
+	unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+	if (seq % 2 != 0 || slot->id != id || slot->len != len) {
+		return false;
+	}
+	memcpy(buf, slot->buffer, len);
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+		clear_buffer(buf, len);
+		return false;
+	}
+	return true;
+}
+
+void comm_password_slot_clear(struct comm_password_slot *slot, uint32_t id) {
+	if (slot->id != id) {
+		return;
+	}
+	unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	clear_buffer(slot->buffer, slot->len);
+	slot->id = 0;
+	slot->len = 0;
+	atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+}
+
+// Reads one request frame. Auth requests carry their password in *buf_ptr.
+static int read_comm_frame(struct comm_request_header *header,
+		char **buf_ptr) {
+	int ret = comm_read_full(comm[0][0], header, sizeof(*header));
+	if (ret == 0) {
 		return 0;
-	} else if (amt < 0) {
+	} else if (ret < 0) {
 		swaylock_log_errno(LOG_ERROR, "read pw request");
 		return -1;
 	}
-	swaylock_log(LOG_DEBUG, "received pw check request");
-	char *buf = password_buffer_create(size);
+	*buf_ptr = NULL;
+	if (header->type != COMM_REQUEST_AUTH) {
+		return 1;
+	}
+
+	swaylock_log(LOG_DEBUG, "received pw check request %u", header->id);
+	if (header->len == 0 || header->len > comm_slot->capacity) {
+		swaylock_log(LOG_ERROR, "invalid pw length %u", header->len);
+		return -1;
+	}
+	char *buf = password_buffer_create(header->len);
 	if (!buf) {
 		return -1;
 	}
-	size_t offs = 0;
-	do {
-		amt = read(comm[0][0], &buf[offs], size - offs);
-		if (amt <= 0) {
-			swaylock_log_errno(LOG_ERROR, "failed to read pw");
+	if (!comm_password_slot_read(comm_slot, header->id, buf, header->len)) {
+		// A newer request is already in the slot, and its frame follows
+		password_buffer_destroy(buf, header->len);
+		swaylock_log(LOG_DEBUG, "dropping pw check request %u", header->id);
+		if (!write_comm_reply(header->id, COMM_STATUS_CANCELLED, 0, NULL)) {
 			return -1;
 		}
-		offs += (size_t)amt;
-	} while (offs < size);
+		// A cancel for no request, which is skipped by all callers
+		header->type = COMM_REQUEST_CANCEL;
+		header->id = 0;
+		return 1;
+	}
+	*buf_ptr = buf;
+	return 1;
+}
 
+static bool comm_request_queued(void) {
+	struct pollfd pfd = {comm[0][0], POLLIN, 0};
+	return poll(&pfd, 1, 0) > 0 && pfd.revents != 0;
+}
+
+static ssize_t read_comm_request_(uint32_t *id, char **buf_ptr, bool block) {
+	struct comm_request_header header;
+	char *buf = NULL;
+	for (;;) {
+		if (!block && !comm_request_queued()) {
+			errno = EAGAIN;
+			return -1;
+		}
+		int ret = read_comm_frame(&header, &buf);
+		if (ret <= 0) {
+			return ret;
+		}
+		if (header.type != COMM_REQUEST_AUTH) {
+			// Cancels a request that is done or already running
+			continue;
+		}
+
+		// Skip to the newest request queued behind this one
+		bool cancelled = false;
+		while (!cancelled && comm_request_queued()) {
+			struct comm_request_header next;
+			char *next_buf = NULL;
+			ret = read_comm_frame(&next, &next_buf);
+			if (ret <= 0) {
+				password_buffer_destroy(buf, header.len);
+				return ret;
+			}
+			if (next.type == COMM_REQUEST_CANCEL && next.id != header.id) {
+				continue;
+			}
+			swaylock_log(LOG_DEBUG, "dropping pw check request %u",
+				header.id);
+			password_buffer_destroy(buf, header.len);
+			if (!write_comm_reply(header.id, COMM_STATUS_CANCELLED, 0, NULL)) {
+				if (next_buf) {
+					password_buffer_destroy(next_buf, next.len);
+				}
+				return -1;
+			}
+			if (next.type == COMM_REQUEST_AUTH) {
+				header = next;
+				buf = next_buf;
+			} else {
+				cancelled = true;
+			}
+		}
+		if (!cancelled) {
+			break;
+		}
+	}
+
+	*id = header.id;
 	*buf_ptr = buf;
-	return size;
+	return header.len;
+}
+
+ssize_t read_comm_request(uint32_t *id, char **buf_ptr) {
+	return read_comm_request_(id, buf_ptr, true);
+}
+
+ssize_t try_read_comm_request(uint32_t *id, char **buf_ptr) {
+	return read_comm_request_(id, buf_ptr, false);
 }
 
-bool write_comm_reply(bool success) {
-	if (write(comm[1][1], &success, sizeof(success)) != sizeof(success)) {
+int get_comm_request_fd(void) {
+	return comm[0][0];
+}
+
+bool write_comm_reply(uint32_t id, enum comm_status status,
+		int retry_after_ms, const char *message) {
+	struct comm_reply_header header = {
+		.id = id,
+		.status = status,
+		.retry_after_ms = retry_after_ms,
+		.message_len = message ? strlen(message) : 0,
+	};
+	if (header.message_len >= COMM_MESSAGE_SIZE) {
+		header.message_len = COMM_MESSAGE_SIZE - 1;
+	}
+	if (!comm_write_full(comm[1][1], &header, sizeof(header)) ||
+			!comm_write_full(comm[1][1], message, header.message_len)) {
 		swaylock_log_errno(LOG_ERROR, "failed to write pw check result");
 		return false;
 	}
 	return true;
 }
 
-bool spawn_comm_child(void) {
+bool spawn_comm_child(void (*run_backend)(void)) {
+	comm_slot = comm_password_slot_create();
+	if (!comm_slot) {
+		return false;
+	}
 	if (pipe(comm[0]) != 0) {
 		swaylock_log_errno(LOG_ERROR, "failed to create pipe");
 		return false;
@@ -62,46 +303,76 @@ bool spawn_comm_child(void) {
 	} else if (child == 0) {
 		close(comm[0][1]);
 		close(comm[1][0]);
-		run_pw_backend_child();
+		password_buffer_pool_forked(true);
+		run_backend();
+		exit(EXIT_SUCCESS);
 	}
 	close(comm[0][0]);
 	close(comm[1][1]);
 	return true;
 }
 
-bool write_comm_request(struct swaylock_password *pw) {
-	bool result = false;
+uint32_t write_comm_request(struct swaylock_password *pw) {
+	uint32_t id = 0;
 
-	size_t len = pw->len + 1;
-	size_t offs = 0;
-	if (write(comm[0][1], &len, sizeof(len)) < 0) {
+	// 0 is never used, so callers can use it for "no request"
+	if (++last_request_id == 0) {
+		++last_request_id;
+	}
+	struct comm_request_header header = {
+		.type = COMM_REQUEST_AUTH,
+		.id = last_request_id,
+		.len = pw->len + 1,
+	};
+	if (!comm_password_slot_write(comm_slot, header.id, pw->buffer,
+			header.len)) {
+		goto out;
+	}
+	if (!comm_write_full(comm[0][1], &header, sizeof(header))) {
 		swaylock_log_errno(LOG_ERROR, "Failed to request pw check");
+		comm_password_slot_clear(comm_slot, header.id);
 		goto out;
 	}
 
-	do {
-		ssize_t amt = write(comm[0][1], &pw->buffer[offs], len - offs);
-		if (amt < 0) {
-			swaylock_log_errno(LOG_ERROR, "Failed to write pw buffer");
-			goto out;
-		}
-		offs += amt;
-	} while (offs < len);
-
-	result = true;
+	id = header.id;
 
 out:
 	clear_password_buffer(pw);
-	return result;
+	return id;
+}
+
+bool write_comm_cancel(uint32_t id) {
+	struct comm_request_header header = {
+		.type = COMM_REQUEST_CANCEL,
+		.id = id,
+		.len = 0,
+	};
+	if (!comm_write_full(comm[0][1], &header, sizeof(header))) {
+		swaylock_log_errno(LOG_ERROR, "Failed to cancel pw check");
+		return false;
+	}
+	return true;
 }
 
-bool read_comm_reply(void) {
-	bool result = false;
-	if (read(comm[1][0], &result, sizeof(result)) != sizeof(result)) {
+bool read_comm_reply(struct comm_reply *reply) {
+	struct comm_reply_header header;
+	if (comm_read_full(comm[1][0], &header, sizeof(header)) != 1) {
 		swaylock_log_errno(LOG_ERROR, "Failed to read pw result");
-		result = false;
+		return false;
 	}
-	return result;
+	size_t len = header.message_len;
+	if (len >= sizeof(reply->message) ||
+			comm_read_full(comm[1][0], reply->message, len) != 1) {
+		swaylock_log_errno(LOG_ERROR, "Failed to read pw result message");
+		return false;
+	}
+	reply->message[len] = '\0';
+	// The password is not needed anymore once its request is answered
+	comm_password_slot_clear(comm_slot, header.id);
+	reply->id = header.id;
+	reply->status = header.status;
+	reply->retry_after_ms = header.retry_after_ms;
+	return true;
 }
 
 int get_comm_reply_fd(void) {
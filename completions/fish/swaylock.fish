@@ -14,6 +14,7 @@ complete -c swaylock -l help                   -s h --description "Show help mes
 complete -c swaylock -l hide-keyboard-layout   -s K --description "Hide the current xkb layout while typing."
 complete -c swaylock -l ignore-empty-password  -s e --description "When an empty password is provided, do not validate it."
 complete -c swaylock -l image                  -s i --description "Display the given image, optionally only on the given output."
+complete -c swaylock -l image-cache                 --description "Cache scaled images on disk."
 complete -c swaylock -l fingerprint               p --description "Enable fingerprint scanning. Fprint is required."
 complete -c swaylock -l indicator-caps-lock    -s l --description "Show the current Caps Lock state also on the indicator."
 complete -c swaylock -l indicator-idle-visible      --description "Sets the indicator to show even if idle."
@@ -38,6 +39,8 @@ complete -c swaylock -l line-uses-ring         -s r --description "Use the ring
 complete -c swaylock -l line-ver-color              --description "Sets the color of the line between the inside and ring when verifying."
 complete -c swaylock -l line-wrong-color            --description "Sets the color of the line between the inside and ring when invalid."
 complete -c swaylock -l no-unlock-indicator    -s u --description "Disable the unlock indicator."
+complete -c swaylock -l pam-prewarm                 --description "Run the PAM account phase once when locking."
+complete -c swaylock -l pam-workers                 --description "Check up to n passwords with PAM at the same time."
 complete -c swaylock -l ring-caps-lock-color        --description "Sets the color of the ring of the indicator when Caps Lock is active."
 complete -c swaylock -l ring-clear-color            --description "Sets the color of the ring of the indicator when cleared."
 complete -c swaylock -l ring-color                  --description "Sets the color of the ring of the indicator."
@@ -47,6 +50,7 @@ complete -c swaylock -l scaling                -s s --description "Image scaling
 complete -c swaylock -l separator-color             --description "Sets the color of the lines that separate highlight segments."
 complete -c swaylock -l show-failed-attempts   -s F --description "Show current count of failed authentication attempts."
 complete -c swaylock -l show-keyboard-layout   -s k --description "Display the current xkb layout while typing."
+complete -c swaylock -l stats                       --description "Print latency percentiles on SIGUSR2 and at exit."
 complete -c swaylock -l text-caps-lock-color        --description "Sets the color of the text when Caps Lock is active."
 complete -c swaylock -l text-clear-color            --description "Sets the color of the text when cleared."
 complete -c swaylock -l text-color                  --description "Sets the color of the text."
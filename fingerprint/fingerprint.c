@@ -25,24 +25,12 @@
 #include <string.h>
 #include <locale.h>
 #include <gio/gio.h>
-#include <sys/wait.h>
+#include <sys/types.h>
+#include <unistd.h>
 
 #include "fingerprint.h"
 #include "log.h"
-
-static bool run_main_context(int init_id, struct FingerprintState *state, int timeout)
-{
-	__time_t start_time = time(NULL);
-	while (time(NULL) - start_time < timeout)
-	{
-		g_main_context_iteration(NULL, TRUE);
-		if (state != NULL && init_id != state->init_id)
-		{
-			return false;
-		}
-	}
-	return true;
-}
+#include "stats.h"
 
 static void restart_fingerprint_usb_device_(bool full)
 {
@@ -56,16 +44,70 @@ static void restart_fingerprint_usb_device_(bool full)
 	}
 }
 
+typedef void (*usb_restart_done_func)(gpointer data);
+
+struct UsbRestart
+{
+	usb_restart_done_func done;
+	gpointer data;
+	guint timeout_id;
+	bool notified;
+};
+
+static void usb_restart_notify(struct UsbRestart *restart)
+{
+	if (!restart->notified)
+	{
+		restart->notified = true;
+		g_clear_handle_id(&restart->timeout_id, g_source_remove);
+		restart->done(restart->data);
+	}
+}
+
+static void usb_restart_child_exited(GPid pid, gint wait_status, gpointer user_data)
+{
+	struct UsbRestart *restart = user_data;
+	g_spawn_close_pid(pid);
+	usb_restart_notify(restart);
+	g_free(restart);
+}
+
+static gboolean usb_restart_timeout_cb(gpointer user_data)
+{
+	struct UsbRestart *restart = user_data;
+	restart->timeout_id = 0;
+	swaylock_log(LOG_DEBUG, "Fingerprint device restart still running, continuing");
+	// The child watch still reaps the process and frees restart
+	usb_restart_notify(restart);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean usb_restart_skipped_cb(gpointer user_data)
+{
+	struct UsbRestart *restart = user_data;
+	usb_restart_notify(restart);
+	g_free(restart);
+	return G_SOURCE_REMOVE;
+}
+
 static int restart_count = 0;
 static int last_usb_restart_time = 0;
 static int last_usb_full_restart_time = 0;
-static void restart_fingerprint_usb_device(bool full, bool wait)
+/* Restarts the device from a child process. done is called from the main loop
+ * once the child exits, after 5 seconds at most, or right away if the
+ * restart is skipped. */
+static void restart_fingerprint_usb_device(bool full, usb_restart_done_func done, gpointer data)
 {
+	struct UsbRestart *restart = g_new0(struct UsbRestart, 1);
+	restart->done = done;
+	restart->data = data;
+
 	swaylock_log(LOG_DEBUG, "Restarting fingerprint device full=%d", full);
 	int current_time = time(NULL);
 	if (current_time - last_usb_full_restart_time < 3)
 	{
 		swaylock_log(LOG_DEBUG, "Skipping fingerprint device restart");
+		g_idle_add(usb_restart_skipped_cb, restart);
 		return;
 	}
 	if (current_time - last_usb_restart_time < 3 || restart_count >= 1)
@@ -81,33 +123,21 @@ static void restart_fingerprint_usb_device(bool full, bool wait)
 		last_usb_full_restart_time = current_time;
 	}
 	restart_count++;
-	if (wait)
+
+	pid_t pid = fork();
+	if (pid < 0)
 	{
-		restart_fingerprint_usb_device_(full);
+		swaylock_log_errno(LOG_ERROR, "Failed to fork for fingerprint device restart");
+		g_idle_add(usb_restart_skipped_cb, restart);
+		return;
 	}
-	else
+	if (pid == 0)
 	{
-		pid_t pid = fork();
-		if (pid < 0)
-		{
-			restart_fingerprint_usb_device_(full);
-			return;
-		}
-		if (pid == 0)
-		{
-			restart_fingerprint_usb_device_(full);
-			exit(0);
-		}
-		else
-		{
-			__time_t start_time = time(NULL);
-			while (waitpid(pid, NULL, WNOHANG) == 0 && time(NULL) - start_time < 5)
-			{
-				run_main_context(0, NULL, 1);
-				g_usleep(100000);
-			}
-		}
+		restart_fingerprint_usb_device_(full);
+		exit(0);
 	}
+	restart->timeout_id = g_timeout_add_seconds(5, usb_restart_timeout_cb, restart);
+	g_child_watch_add(pid, usb_restart_child_exited, restart);
 }
 
 static bool should_disable_fingerprint(const struct FingerprintState *state)
@@ -115,6 +145,36 @@ static bool should_disable_fingerprint(const struct FingerprintState *state)
 	return state->fail_count >= 10 || state->restart_count >= 3;
 }
 
+static gboolean verify_source_cb(gpointer user_data)
+{
+	struct FingerprintState *state = user_data;
+	state->verify_source_id = 0;
+	if (fingerprint_verify(state))
+	{
+		// Fingerprint matched, unlock
+		auth_broker_succeeded(state->sw_state, AUTH_SOURCE_FINGERPRINT);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+/* Run fingerprint_verify once the current GLib dispatch is done. All state
+ * changes go through here, so nothing has to poll the device state. */
+static void request_verify(struct FingerprintState *state)
+{
+	if (state->verify_source_id == 0)
+	{
+		state->verify_source_id = g_idle_add(verify_source_cb, state);
+	}
+}
+
+static gboolean idle_timeout_cb(gpointer user_data)
+{
+	struct FingerprintState *state = user_data;
+	state->idle_timeout_id = 0;
+	request_verify(state);
+	return G_SOURCE_REMOVE;
+}
+
 static void display_message(struct FingerprintState *state, const char *fmt, ...)
 {
 	va_list(args);
@@ -124,6 +184,7 @@ static void display_message(struct FingerprintState *state, const char *fmt, ...
 
 	state->sw_state->auth_state = AUTH_STATE_FINGERPRINT;
 	state->sw_state->fingerprint_msg = state->status;
+	auth_broker_activity(state->sw_state, AUTH_SOURCE_FINGERPRINT);
 	damage_state(state->sw_state);
 	schedule_auth_idle(state->sw_state);
 }
@@ -136,50 +197,142 @@ static void display_driver_message(struct FingerprintState *state, const char *f
 	va_end(args);
 
 	state->sw_state->fingerprint_driver_msg = state->driver_status;
-	damage_state(state->sw_state);
+	damage_surfaces(state->sw_state, DAMAGE_FINGERPRINT_STATUS);
 	schedule_auth_idle(state->sw_state);
 }
 
-static void create_manager(struct FingerprintState *state)
+static void destroy_manager(struct FingerprintState *state)
 {
-	g_autoptr(GError) error = NULL;
-	state->connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
-	if (state->connection == NULL)
+	g_clear_object(&state->manager);
+	g_clear_object(&state->connection);
+}
+
+struct FingerprintStateWithInitId
+{
+	struct FingerprintState *state;
+	int init_id;
+	char *path;
+	FprintDBusDevice *device;
+};
+
+static void create_manager_bus_cb(GObject *source_object,
+								  GAsyncResult *res,
+								  gpointer data);
+
+static void create_manager_start(gpointer data)
+{
+	struct FingerprintStateWithInitId *state_wrapper = data;
+	if (state_wrapper->init_id != state_wrapper->state->init_id)
 	{
-		swaylock_log(LOG_ERROR, "Failed to connect to session bus: %s", error->message);
-		display_driver_message(state, "Failed to connect to session bus: %s", error->message);
+		g_free(state_wrapper);
+		return;
+	}
+	state_wrapper->state->last_signal_time = time(NULL);
+	g_bus_get(G_BUS_TYPE_SYSTEM, NULL, create_manager_bus_cb, state_wrapper);
+}
+
+static gboolean create_manager_retry_cb(gpointer user_data)
+{
+	struct FingerprintStateWithInitId *state_wrapper = user_data;
+	if (state_wrapper->init_id != state_wrapper->state->init_id)
+	{
+		g_free(state_wrapper);
+		return G_SOURCE_REMOVE;
+	}
+	if (++state_wrapper->state->manager_try_count % 2 == 0)
+	{
+		restart_fingerprint_usb_device(false, create_manager_start, state_wrapper);
+	}
+	else
+	{
+		create_manager_start(state_wrapper);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void create_manager_failed(struct FingerprintStateWithInitId *state_wrapper)
+{
+	struct FingerprintState *state = state_wrapper->state;
+	destroy_manager(state);
+	if (state->manager_try_count >= 5 || time(NULL) - state->manager_start_time > 60)
+	{
+		swaylock_log(LOG_ERROR, "Failed to initialize fingerprint");
+		display_driver_message(state, "Failed to initialize fingerprint");
+		g_free(state_wrapper);
 		return;
 	}
+	g_timeout_add_seconds(3, create_manager_retry_cb, state_wrapper);
+}
 
-	state->manager = fprint_dbus_manager_proxy_new_sync(
-		state->connection,
-		G_DBUS_PROXY_FLAGS_NONE,
-		"net.reactivated.Fprint",
-		"/net/reactivated/Fprint/Manager",
-		NULL, &error);
-	if (state->manager == NULL)
+static void create_manager_proxy_cb(GObject *source_object,
+									GAsyncResult *res,
+									gpointer data)
+{
+	struct FingerprintStateWithInitId *state_wrapper = data;
+	g_autoptr(GError) error = NULL;
+	FprintDBusManager *manager = fprint_dbus_manager_proxy_new_finish(res, &error);
+	if (state_wrapper->init_id != state_wrapper->state->init_id)
+	{
+		g_clear_object(&manager);
+		g_free(state_wrapper);
+		return;
+	}
+	if (manager == NULL)
 	{
 		swaylock_log(LOG_ERROR, "Failed to get Fprintd manager: %s", error->message);
-		display_driver_message(state, "Failed to get Fprintd manager: %s", error->message);
+		display_driver_message(state_wrapper->state, "Failed to get Fprintd manager: %s", error->message);
+		create_manager_failed(state_wrapper);
 		return;
 	}
 
+	struct FingerprintState *state = state_wrapper->state;
+	g_free(state_wrapper);
+	state->manager = manager;
 	swaylock_log(LOG_DEBUG, "FPrint manager created");
+	request_verify(state);
 }
 
-static void destroy_manager(struct FingerprintState *state)
+static void create_manager_bus_cb(GObject *source_object,
+								  GAsyncResult *res,
+								  gpointer data)
 {
-	g_clear_object(&state->manager);
-	g_clear_object(&state->connection);
+	struct FingerprintStateWithInitId *state_wrapper = data;
+	g_autoptr(GError) error = NULL;
+	GDBusConnection *connection = g_bus_get_finish(res, &error);
+	if (state_wrapper->init_id != state_wrapper->state->init_id)
+	{
+		g_clear_object(&connection);
+		g_free(state_wrapper);
+		return;
+	}
+	if (connection == NULL)
+	{
+		swaylock_log(LOG_ERROR, "Failed to connect to session bus: %s", error->message);
+		display_driver_message(state_wrapper->state, "Failed to connect to session bus: %s", error->message);
+		create_manager_failed(state_wrapper);
+		return;
+	}
+
+	state_wrapper->state->connection = connection;
+	fprint_dbus_manager_proxy_new(
+		connection,
+		G_DBUS_PROXY_FLAGS_NONE,
+		"net.reactivated.Fprint",
+		"/net/reactivated/Fprint/Manager",
+		NULL,
+		create_manager_proxy_cb,
+		state_wrapper);
 }
 
-struct FingerprintStateWithInitId
+static void create_manager(struct FingerprintState *state)
 {
-	struct FingerprintState *state;
-	int init_id;
-	char *path;
-	FprintDBusDevice *device;
-};
+	struct FingerprintStateWithInitId *state_wrapper = g_new0(struct FingerprintStateWithInitId, 1);
+	state_wrapper->state = state;
+	state_wrapper->init_id = state->init_id;
+	state->manager_try_count = 1;
+	state->manager_start_time = time(NULL);
+	create_manager_start(state_wrapper);
+}
 
 static void start_verify(struct FingerprintState *state);
 static void proxy_signal_cb(GDBusProxy *proxy,
@@ -199,6 +352,11 @@ static void connect_signal_and_start_verify(struct FingerprintState *state)
 }
 
 static gboolean restart_verify_step_1(gpointer user_data);
+static void schedule_restart_verify(gpointer data)
+{
+	g_timeout_add_seconds(1, restart_verify_step_1, data);
+}
+
 static void open_device_async_device_claim_cb(GObject *source_object,
 											  GAsyncResult *res,
 											  gpointer data)
@@ -224,8 +382,6 @@ static void open_device_async_device_claim_cb(GObject *source_object,
 			return;
 		}
 
-		restart_fingerprint_usb_device(false, false);
-
 		struct FingerprintState *state = state_wrapper->state;
 		state_wrapper->state->openning_device = 0;
 		g_object_unref(state_wrapper->device);
@@ -234,7 +390,7 @@ static void open_device_async_device_claim_cb(GObject *source_object,
 
 		state->restarting = true;
 		state->rebind_usb = true;
-		g_timeout_add_seconds(1, restart_verify_step_1, state);
+		restart_fingerprint_usb_device(false, schedule_restart_verify, state);
 		return;
 	}
 
@@ -277,6 +433,30 @@ static void open_device_async_device_proxy_new_cb(GObject *source_object,
 								  state_wrapper);
 }
 
+static void open_device_async_get_default_device_cb(GObject *source_object,
+													GAsyncResult *res,
+													gpointer data);
+
+static gboolean get_default_device_retry_cb(gpointer user_data)
+{
+	struct FingerprintStateWithInitId *state_wrapper = user_data;
+	if (state_wrapper->init_id != state_wrapper->state->init_id)
+	{
+		g_free(state_wrapper);
+		return G_SOURCE_REMOVE;
+	}
+	fprint_dbus_manager_call_get_default_device(state_wrapper->state->manager, NULL,
+												open_device_async_get_default_device_cb,
+												state_wrapper);
+	return G_SOURCE_REMOVE;
+}
+
+// Give the device some time to come back after a restart
+static void get_default_device_retry_later(gpointer data)
+{
+	g_timeout_add_seconds(3, get_default_device_retry_cb, data);
+}
+
 static void open_device_async_get_default_device_cb(GObject *source_object,
 													GAsyncResult *res,
 													gpointer data)
@@ -298,12 +478,8 @@ static void open_device_async_get_default_device_cb(GObject *source_object,
 		int ntry = ++state_wrapper->state->open_device_fail_count;
 		if (ntry >= 2 && ntry <= 3)
 		{
-			restart_fingerprint_usb_device(ntry == 3, false);
-			if (!run_main_context(state_wrapper->init_id, state_wrapper->state, 3))
-			{
-				g_free(state_wrapper);
-				return;
-			}
+			restart_fingerprint_usb_device(ntry == 3, get_default_device_retry_later, state_wrapper);
+			return;
 		}
 		if (ntry < 5)
 		{
@@ -358,58 +534,35 @@ static void open_device_async(struct FingerprintState *state)
 												state_wrapper);
 }
 
-static bool is_suspending_or_hibernating_or_lid_closed()
+static bool get_login_manager_flag(struct FingerprintState *state, const char *name)
 {
-	GError *error = NULL;
-	GDBusProxy *proxy = g_dbus_proxy_new_for_bus_sync(
-		G_BUS_TYPE_SYSTEM,
-		G_DBUS_PROXY_FLAGS_NONE,
-		NULL,
-		"org.freedesktop.login1",
-		"/org/freedesktop/login1",
-		"org.freedesktop.login1.Manager",
-		NULL, &error);
-
-	if (error)
-	{
-		g_error_free(error);
-		return false;
-	}
-
 	bool flag = false;
-	GVariant *result = g_dbus_proxy_get_cached_property(proxy, "PreparingForShutdown");
+	GVariant *result = g_dbus_proxy_get_cached_property(state->login_manager, name);
 	if (result)
 	{
 		flag = g_variant_get_boolean(result);
 		g_variant_unref(result);
 	}
-	if (!flag)
-	{
-		result = g_dbus_proxy_get_cached_property(proxy, "PreparingForSleep");
-		if (result)
-		{
-			flag = g_variant_get_boolean(result);
-			g_variant_unref(result);
-		}
-	}
-	if (!flag)
+	return flag;
+}
+
+// The login1 proxy keeps these properties up to date from PropertiesChanged,
+// so this does not need a round-trip to the system bus.
+static bool is_suspending_or_hibernating_or_lid_closed(struct FingerprintState *state)
+{
+	if (!state->login_manager)
 	{
-		result = g_dbus_proxy_get_cached_property(proxy, "LidClosed");
-		if (result)
-		{
-			flag = g_variant_get_boolean(result);
-			g_variant_unref(result);
-		}
+		return false;
 	}
 
-	g_object_unref(proxy);
-
-	return flag;
+	return get_login_manager_flag(state, "PreparingForShutdown") ||
+		   get_login_manager_flag(state, "PreparingForSleep") ||
+		   get_login_manager_flag(state, "LidClosed");
 }
 
 static void fingerprint_init2(struct FingerprintState *fingerprint_state)
 {
-	int current_init_id = ++fingerprint_state->init_id;
+	++fingerprint_state->init_id;
 	fingerprint_state->initialized = true;
 	fingerprint_state->last_signal_time = time(NULL);
 	fingerprint_state->continous_unknown_error_count = 0;
@@ -418,42 +571,13 @@ static void fingerprint_init2(struct FingerprintState *fingerprint_state)
 	display_driver_message(fingerprint_state, "Initializing...");
 
 	// if device is suspending or hibernating, don't initialize
-	if (is_suspending_or_hibernating_or_lid_closed())
+	if (is_suspending_or_hibernating_or_lid_closed(fingerprint_state))
 	{
 		display_driver_message(fingerprint_state, "Suspended");
 		return;
 	}
 
 	create_manager(fingerprint_state);
-	__time_t start_time = time(NULL);
-	__time_t last_try_time = start_time;
-	int try_count = 1;
-	while (fingerprint_state->manager == NULL || fingerprint_state->connection == NULL)
-	{
-		g_main_context_iteration(NULL, TRUE);
-		if (current_init_id != fingerprint_state->init_id)
-		{
-			return;
-		}
-		__time_t current_time = time(NULL);
-		if (try_count > 5 || current_time - start_time > 60)
-		{
-			swaylock_log(LOG_ERROR, "Failed to initialize fingerprint");
-			display_driver_message(fingerprint_state, "Failed to initialize fingerprint");
-			return;
-		}
-		if (current_time - last_try_time > 3)
-		{
-			last_try_time = current_time;
-			++try_count;
-			if (try_count % 2 == 0)
-			{
-				restart_fingerprint_usb_device(false, false);
-			}
-			fingerprint_state->last_signal_time = time(NULL);
-			create_manager(fingerprint_state);
-		}
-	}
 }
 
 static gboolean restart_verify_step_2(gpointer user_data)
@@ -467,7 +591,7 @@ static gboolean restart_verify_step_2(gpointer user_data)
 	{
 		fingerprint_init2(state);
 		display_message(state, "");
-		fingerprint_verify(state);
+		request_verify(state);
 	}
 	else
 	{
@@ -479,6 +603,11 @@ static gboolean restart_verify_step_2(gpointer user_data)
 	return G_SOURCE_REMOVE;
 }
 
+static void schedule_restart_verify_step_2(gpointer data)
+{
+	g_timeout_add_seconds_full(G_PRIORITY_HIGH, 1, restart_verify_step_2, data, NULL);
+}
+
 static gboolean restart_verify_step_1(gpointer user_data)
 {
 	struct FingerprintState *state = user_data;
@@ -492,12 +621,67 @@ static gboolean restart_verify_step_1(gpointer user_data)
 	if (state->rebind_usb)
 	{
 		state->rebind_usb = false;
-		restart_fingerprint_usb_device(false, false);
+		restart_fingerprint_usb_device(false, schedule_restart_verify_step_2, state);
+		return G_SOURCE_REMOVE;
 	}
-	g_timeout_add_seconds_full(G_PRIORITY_HIGH, 1, restart_verify_step_2, state, NULL);
+	schedule_restart_verify_step_2(state);
 	return G_SOURCE_REMOVE;
 }
 
+struct VerifyStopRequest
+{
+	struct FingerprintState *state;
+	int init_id;
+	bool kill;
+	bool should_restart;
+};
+
+static void verify_stop_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	struct VerifyStopRequest *request = user_data;
+	struct FingerprintState *state = request->state;
+	bool stale = request->init_id != state->init_id;
+	bool kill = request->kill;
+	bool should_restart = request->should_restart;
+	g_free(request);
+
+	g_autoptr(GError) error = NULL;
+	if (!fprint_dbus_device_call_verify_stop_finish(FPRINT_DBUS_DEVICE(source_object), res, &error))
+	{
+		if (!stale)
+		{
+			swaylock_log(LOG_ERROR, "VerifyStop failed: %s", error->message);
+			display_driver_message(state, "Failed to stop verification: %s", error->message);
+			request_verify(state);
+		}
+		return;
+	}
+	if (stale)
+	{
+		return;
+	}
+
+	if (kill)
+	{
+		fingerprint_deinit(state);
+	}
+	else if (should_restart && !state->match)
+	{
+		__time_t current_time = time(NULL);
+		if (current_time - state->last_activity_time > 60)
+		{
+			fingerprint_deinit(state);
+			return;
+		}
+		swaylock_log(LOG_DEBUG, "Restarting verification");
+		state->restarting = true;
+		state->rebind_usb = true;
+		g_timeout_add_seconds(1, restart_verify_step_1, state);
+		return;
+	}
+	request_verify(state);
+}
+
 static void verify_result(GObject *object, const char *result, gboolean done, void *user_data)
 {
 	struct FingerprintState *state = user_data;
@@ -597,44 +781,61 @@ static void verify_result(GObject *object, const char *result, gboolean done, vo
 
 	state->completed = TRUE;
 	state->verifying = FALSE;
-	g_autoptr(GError) error = NULL;
-	if (!fprint_dbus_device_call_verify_stop_sync(state->device, NULL, &error))
+	if (state->match)
 	{
-		swaylock_log(LOG_ERROR, "VerifyStop failed: %s", error->message);
-		display_driver_message(state, "Failed to stop verification: %s", error->message);
-		return;
+		// Unlock right away, stopping the device is not needed for that
+		request_verify(state);
 	}
 
-	if (kill)
-	{
-		fingerprint_deinit(state);
-	}
-	else if (should_restart && !state->match)
-	{
-		__time_t current_time = time(NULL);
-		if (current_time - state->last_activity_time > 60)
-		{
-			fingerprint_deinit(state);
-			return;
-		}
-		swaylock_log(LOG_DEBUG, "Restarting verification");
-		state->restarting = true;
-		state->rebind_usb = true;
-		g_timeout_add_seconds(1, restart_verify_step_1, state);
-	}
+	struct VerifyStopRequest *request = g_new(struct VerifyStopRequest, 1);
+	request->state = state;
+	request->init_id = state->init_id;
+	request->kill = kill;
+	request->should_restart = should_restart;
+	fprint_dbus_device_call_verify_stop(state->device, NULL, verify_stop_cb, request);
 }
 
 static void verify_started_cb(GObject *obj, GAsyncResult *res, gpointer user_data)
 {
 	struct FingerprintState *state = user_data;
-	if (!fprint_dbus_device_call_verify_start_finish(FPRINT_DBUS_DEVICE(obj), res, &state->error))
+	g_autoptr(GError) error = NULL;
+	if (!fprint_dbus_device_call_verify_start_finish(FPRINT_DBUS_DEVICE(obj), res, &error) &&
+		g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
 	{
+		// The device was closed or the start timed out, already handled
+		return;
+	}
+	g_clear_object(&state->verify_cancellable);
+	g_clear_handle_id(&state->verify_start_timeout_id, g_source_remove);
+	stats_record(STATS_FINGERPRINT_START, state->verify_start_stats_time);
+
+	if (error)
+	{
+		swaylock_log(LOG_ERROR, "VerifyStart failed: %s", error->message);
+		display_driver_message(state, "Failed to start verification: %s", error->message);
 		return;
 	}
 
 	swaylock_log(LOG_DEBUG, "Verify started!");
 	state->started = TRUE;
 	display_driver_message(state, "Scan your finger");
+	if (!*state->status)
+	{
+		display_message(state, "...");
+	}
+}
+
+static gboolean verify_start_timeout_cb(gpointer user_data)
+{
+	struct FingerprintState *state = user_data;
+	state->verify_start_timeout_id = 0;
+	g_cancellable_cancel(state->verify_cancellable);
+	g_clear_object(&state->verify_cancellable);
+	swaylock_log(LOG_ERROR, "VerifyStart timeout");
+	display_driver_message(state, "Failed to start verification (timeout)");
+	state->restarting = true;
+	g_timeout_add_seconds(1, restart_verify_step_1, state);
+	return G_SOURCE_REMOVE;
 }
 
 static void proxy_signal_cb(GDBusProxy *proxy,
@@ -662,6 +863,7 @@ static void proxy_signal_cb(GDBusProxy *proxy,
 	const gchar *result;
 	gboolean done;
 	g_variant_get(parameters, "(&sb)", &result, &done);
+	stats_record(STATS_FINGERPRINT_STATUS, state->verify_start_stats_time);
 	verify_result(G_OBJECT(proxy), result, done, user_data);
 }
 
@@ -676,12 +878,15 @@ static void start_verify(struct FingerprintState *state)
 		return;
 	}
 	state->last_start_verify_time = time(NULL);
+	state->verify_start_stats_time = stats_now();
+	// Re-check once verification has been idle for too long
+	g_clear_handle_id(&state->idle_timeout_id, g_source_remove);
+	state->idle_timeout_id = g_timeout_add_seconds(61, idle_timeout_cb, state);
 	swaylock_log(LOG_DEBUG, "Starting verification");
 	state->verifying = true;
 	state->started = 0;
 	state->completed = 0;
 	state->match = 0;
-	int current_init_id = state->init_id;
 	/* This one is funny. We connect to the signal immediately to avoid
 	 * race conditions. However, we must ignore any authentication results
 	 * that happen before our start call returns.
@@ -690,45 +895,14 @@ static void start_verify(struct FingerprintState *state)
 	 *
 	 * To do so, we *must* use the async version of the verify call, as the
 	 * sync version would cause the signals to be queued and only processed
-	 * after it returns.
+	 * after it returns. VerifyStatus signals are discarded by
+	 * proxy_signal_cb until verify_started_cb has run.
 	 */
-	g_autoptr(GCancellable) cancellable = g_cancellable_new();
-	fprint_dbus_device_call_verify_start(state->device, "any", cancellable,
+	state->verify_cancellable = g_cancellable_new();
+	fprint_dbus_device_call_verify_start(state->device, "any", state->verify_cancellable,
 										 verify_started_cb,
 										 state);
-
-	__time_t start_time = time(NULL);
-	/* Wait for verify start while discarding any VerifyStatus signals */
-	while (!state->started && !state->error)
-	{
-		g_main_context_iteration(NULL, TRUE);
-		if (current_init_id != state->init_id)
-		{
-			return;
-		}
-		if (time(NULL) - start_time > 10)
-		{
-			g_cancellable_cancel(cancellable);
-			swaylock_log(LOG_ERROR, "VerifyStart timeout");
-			display_driver_message(state, "Failed to start verification (timeout)");
-			state->restarting = true;
-			g_timeout_add_seconds(1, restart_verify_step_1, state);
-			return;
-		}
-	}
-
-	swaylock_log(LOG_DEBUG, "Verify started, state->error=%p", state->error);
-
-	if (state->error)
-	{
-		swaylock_log(LOG_ERROR, "VerifyStart failed: %s", state->error->message);
-		display_driver_message(state, "Failed to start verification: %s", state->error->message);
-		g_clear_error(&state->error);
-	}
-	else if (!*state->status)
-	{
-		display_message(state, "...");
-	}
+	state->verify_start_timeout_id = g_timeout_add_seconds(10, verify_start_timeout_cb, state);
 }
 
 static void release_callback(GObject *source_object, GAsyncResult *res,
@@ -736,6 +910,13 @@ static void release_callback(GObject *source_object, GAsyncResult *res,
 {
 }
 
+static void resume_after_usb_restart(gpointer data)
+{
+	struct FingerprintState *state = data;
+	fingerprint_init2(state);
+	request_verify(state);
+}
+
 static void handle_sleep_signal(GDBusProxy *proxy,
 								const gchar *sender_name,
 								const gchar *signal_name,
@@ -749,13 +930,15 @@ static void handle_sleep_signal(GDBusProxy *proxy,
 	struct FingerprintState *state = user_data;
 	gboolean going_to_sleep;
 	g_variant_get(parameters, "(b)", &going_to_sleep);
+	// PreparingForSleep does not emit PropertiesChanged, keep the cache in sync
+	g_dbus_proxy_set_cached_property(proxy, "PreparingForSleep",
+									 g_variant_new_boolean(going_to_sleep));
 
 	if (!going_to_sleep)
 	{ // System is resuming
 		swaylock_log(LOG_DEBUG, "System resumed, restarting fingerprint verification.");
 		fingerprint_deinit(state);
-		restart_fingerprint_usb_device(false, true);
-		fingerprint_init2(state);
+		restart_fingerprint_usb_device(false, resume_after_usb_restart, state);
 	}
 	else
 	{
@@ -764,36 +947,55 @@ static void handle_sleep_signal(GDBusProxy *proxy,
 	}
 }
 
+static void login_manager_proxy_cb(GObject *source_object,
+								   GAsyncResult *res,
+								   gpointer user_data)
+{
+	struct FingerprintState *state = user_data;
+	g_autoptr(GError) error = NULL;
+	state->login_manager = g_dbus_proxy_new_for_bus_finish(res, &error);
+	if (!state->login_manager)
+	{
+		swaylock_log(LOG_ERROR, "Failed to connect to login1: %s", error->message);
+	}
+	else
+	{
+		// Connect to the PrepareForSleep signal
+		g_signal_connect(state->login_manager, "g-signal",
+						 G_CALLBACK(handle_sleep_signal), state);
+	}
+
+	// A key press may already have started verification without login1
+	if (!state->initialized)
+	{
+		fingerprint_init2(state);
+	}
+}
+
+static void fingerprint_cancel(void *data);
+
 void fingerprint_init(struct FingerprintState *fingerprint_state,
 					  struct swaylock_state *swaylock_state)
 {
 	memset(fingerprint_state, 0, sizeof(struct FingerprintState));
 	fingerprint_state->sw_state = swaylock_state;
+	auth_broker_add_source(swaylock_state, AUTH_SOURCE_FINGERPRINT,
+						   fingerprint_cancel, fingerprint_state);
 
-	fingerprint_init2(fingerprint_state);
-
-	// Connect to the PrepareForSleep signal
-	GDBusProxy *login_manager_proxy = g_dbus_proxy_new_for_bus_sync(
+	// The suspend state is needed before opening the device, so the rest of
+	// the initialization continues once the proxy and its properties are in.
+	g_dbus_proxy_new_for_bus(
 		G_BUS_TYPE_SYSTEM,
 		G_DBUS_PROXY_FLAGS_NONE,
 		NULL,
 		"org.freedesktop.login1",
 		"/org/freedesktop/login1",
 		"org.freedesktop.login1.Manager",
-		NULL, NULL);
-	g_signal_connect(login_manager_proxy, "g-signal",
-					 G_CALLBACK(handle_sleep_signal), fingerprint_state);
+		NULL, login_manager_proxy_cb, fingerprint_state);
 }
 
 int fingerprint_verify(struct FingerprintState *fingerprint_state)
 {
-	int current_init_id = fingerprint_state->init_id;
-	/* VerifyStatus signals are processing, do not wait for completion. */
-	g_main_context_iteration(NULL, FALSE);
-	if (current_init_id != fingerprint_state->init_id)
-	{
-		return false;
-	}
 	if (fingerprint_state->restarting)
 	{
 		return false;
@@ -880,6 +1082,13 @@ int fingerprint_verify(struct FingerprintState *fingerprint_state)
 
 static void fingerprint_close_device(struct FingerprintState *fingerprint_state)
 {
+	g_clear_handle_id(&fingerprint_state->verify_start_timeout_id, g_source_remove);
+	if (fingerprint_state->verify_cancellable)
+	{
+		g_cancellable_cancel(fingerprint_state->verify_cancellable);
+		g_clear_object(&fingerprint_state->verify_cancellable);
+	}
+
 	if (!fingerprint_state->device)
 	{
 		return;
@@ -891,21 +1100,35 @@ static void fingerprint_close_device(struct FingerprintState *fingerprint_state)
 	fingerprint_state->device = NULL;
 }
 
-void fingerprint_deinit(struct FingerprintState *fingerprint_state)
+static void fingerprint_stop(struct FingerprintState *fingerprint_state)
 {
-	if (!fingerprint_state->match)
-	{
-		display_driver_message(fingerprint_state, "Press any key to reenable fingerprint");
-	}
 	fingerprint_state->initialized = false;
 	fingerprint_state->init_id++;
 	fingerprint_state->verifying = false;
+	g_clear_handle_id(&fingerprint_state->idle_timeout_id, g_source_remove);
+	g_clear_handle_id(&fingerprint_state->verify_source_id, g_source_remove);
 	fingerprint_close_device(fingerprint_state);
 	destroy_manager(fingerprint_state);
 }
 
+// Another factor unlocked, release the device without any further status
+static void fingerprint_cancel(void *data)
+{
+	fingerprint_stop(data);
+}
+
+void fingerprint_deinit(struct FingerprintState *fingerprint_state)
+{
+	if (!fingerprint_state->match)
+	{
+		display_driver_message(fingerprint_state, "Press any key to reenable fingerprint");
+	}
+	fingerprint_stop(fingerprint_state);
+}
+
 void fingerprint_set_restart_flag(struct FingerprintState *fingerprint_state, bool force)
 {
 	fingerprint_state->flag_idle_restart |= force ? 2 : 1;
 	fingerprint_state->last_activity_time = time(NULL);
+	request_verify(fingerprint_state);
 }
\ No newline at end of file
@@ -25,7 +25,6 @@
 struct FingerprintState {
 	gboolean initialized;
 
-	GError	*error;
 	gboolean rebind_usb;
 	gboolean restarting;
 	gboolean started;
@@ -40,6 +39,7 @@ struct FingerprintState {
 
 	int open_device_fail_count;
 	int claim_device_fail_count;
+	int manager_try_count;
 
 	int init_id;
 	int continous_unknown_error_count;
@@ -48,11 +48,22 @@ struct FingerprintState {
 	__time_t last_signal_time;
 	__time_t last_start_verify_time;
 	__time_t last_activity_time;
+	__time_t manager_start_time;
+	uint64_t verify_start_stats_time;
+
+	// GLib sources that drive fingerprint_verify, 0 when not scheduled
+	guint verify_source_id;
+	guint idle_timeout_id;
+	guint verify_start_timeout_id;
+	GCancellable *verify_cancellable;
 
 	char status[128];
 
 	char driver_status[128];
 
+	// Long-lived org.freedesktop.login1.Manager proxy, NULL until connected
+	GDBusProxy *login_manager;
+
 	FprintDBusManager *manager;
 	GDBusConnection *connection;
 	FprintDBusDevice *device;
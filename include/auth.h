@@ -0,0 +1,56 @@
+#ifndef _SWAYLOCK_AUTH_H
+#define _SWAYLOCK_AUTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The auth broker arbitrates between authentication factors that run
+ * concurrently. The first one to succeed unlocks and cancels the others, and
+ * a failure only updates the indicator if no other factor has shown anything
+ * since that attempt started.
+ */
+
+struct swaylock_state;
+
+enum auth_source {
+	AUTH_SOURCE_PASSWORD,
+	AUTH_SOURCE_FINGERPRINT,
+	AUTH_SOURCE_COUNT,
+};
+
+struct auth_broker_source {
+	bool registered;
+	void (*cancel)(void *data);
+	void *data;
+	uint64_t activity; // broker activity count at its latest attempt or status
+};
+
+struct auth_broker {
+	struct auth_broker_source sources[AUTH_SOURCE_COUNT];
+	uint64_t activity;
+	bool done;
+};
+
+/**
+ * Register a factor. cancel is called if another factor unlocks first.
+ */
+void auth_broker_add_source(struct swaylock_state *state,
+	enum auth_source source, void (*cancel)(void *data), void *data);
+
+/**
+ * Record that a factor started an attempt or showed a status.
+ */
+void auth_broker_activity(struct swaylock_state *state, enum auth_source source);
+
+/**
+ * Unlock, unless another factor already did, and cancel the other factors.
+ */
+void auth_broker_succeeded(struct swaylock_state *state, enum auth_source source);
+
+/**
+ * Returns whether the failure of a factor's latest attempt should be shown.
+ */
+bool auth_broker_failed(struct swaylock_state *state, enum auth_source source);
+
+#endif
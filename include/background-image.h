@@ -1,5 +1,6 @@
 #ifndef _SWAY_BACKGROUND_IMAGE_H
 #define _SWAY_BACKGROUND_IMAGE_H
+#include <stdbool.h>
 #include "cairo.h"
 
 enum background_mode {
@@ -16,5 +17,31 @@ enum background_mode parse_background_mode(const char *mode);
 cairo_surface_t *load_background_image(const char *path);
 void render_background_image(cairo_t *cairo, cairo_surface_t *image,
 		enum background_mode mode, int buffer_width, int buffer_height);
+/**
+ * Enables the on-disk cache of scaled backgrounds in $XDG_CACHE_HOME/swaylock.
+ */
+bool init_background_cache(void);
+/**
+ * Returns the image at path rendered over the background color at the given
+ * buffer size. The result comes from the in-memory cache, then the on-disk
+ * cache, and is only rendered from image as a last resort; image may be NULL
+ * if it has not been decoded, in which case NULL is returned on a miss. The
+ * surface is owned by the cache and stays valid until the next call, or until
+ * control returns to the main loop.
+ *
+ * Rendering from image happens on a worker thread, so that several outputs
+ * are scaled in parallel. NULL is returned meanwhile, and ready(data) is
+ * called from the GLib main context once the result is cached.
+ */
+cairo_surface_t *get_scaled_background(const char *path, cairo_surface_t *image,
+		enum background_mode mode, uint32_t color,
+		int buffer_width, int buffer_height,
+		void (*ready)(void *data), void *data);
+/**
+ * Drops a surface returned by get_scaled_background from the in-memory
+ * cache, once the caller keeps a copy of its own. It is scaled again, or read
+ * from the on-disk cache, if it is asked for later.
+ */
+void release_scaled_background(cairo_surface_t *surface);
 
 #endif
@@ -2,16 +2,71 @@
 #define _SWAYLOCK_COMM_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define COMM_MESSAGE_SIZE 256
 
 struct swaylock_password;
 
-bool spawn_comm_child(void);
-ssize_t read_comm_request(char **buf_ptr);
-bool write_comm_reply(bool success);
-// Requests the provided password to be checked. The password is always cleared
-// when the function returns.
-bool write_comm_request(struct swaylock_password *pw);
-bool read_comm_reply(void);
+enum comm_status {
+	COMM_STATUS_SUCCESS,
+	// The password was wrong
+	COMM_STATUS_FAILURE,
+	// The backend could not check the password, see the message
+	COMM_STATUS_ERROR,
+	// The request was superseded or cancelled before it was checked
+	COMM_STATUS_CANCELLED,
+};
+
+struct comm_reply {
+	uint32_t id; // of the request this answers
+	enum comm_status status;
+	int retry_after_ms; // minimum delay the backend puts before the next check
+	char message[COMM_MESSAGE_SIZE];
+};
+
+// Returns 1 once size bytes are read, 0 on end of file before any data, or
+// -1 on errors and truncated data.
+int comm_read_full(int fd, void *buf, size_t size);
+bool comm_write_full(int fd, const void *buf, size_t size);
+
+struct comm_password_slot;
+
+// Creates a locked page shared with processes forked after it, used to hand
+// one password at a time to them without copying it through a pipe.
+struct comm_password_slot *comm_password_slot_create(void);
+bool comm_password_slot_write(struct comm_password_slot *slot, uint32_t id,
+	const char *buf, size_t len);
+// Copies the password of request id to buf. Fails if the slot holds a
+// different request by now.
+bool comm_password_slot_read(struct comm_password_slot *slot, uint32_t id,
+	char *buf, size_t len);
+// Wipes the slot if it still holds the password of request id.
+void comm_password_slot_clear(struct comm_password_slot *slot, uint32_t id);
+
+// Forks the process that checks passwords and runs run_backend in it, which
+// takes requests with read_comm_request and answers them with
+// write_comm_reply. Backends pass run_pw_backend_child, but any verifier
+// speaking the same protocol can be plugged in, e.g. a fake one to measure or
+// fault the pipeline. The child exits if run_backend returns.
+bool spawn_comm_child(void (*run_backend)(void));
+// Returns the newest queued request, answering the ones it supersedes.
+ssize_t read_comm_request(uint32_t *id, char **buf_ptr);
+// Same as read_comm_request, but fails with EAGAIN instead of blocking once
+// no more requests are queued.
+ssize_t try_read_comm_request(uint32_t *id, char **buf_ptr);
+// FD to poll for password authentication requests, in the backend child.
+int get_comm_request_fd(void);
+bool write_comm_reply(uint32_t id, enum comm_status status,
+	int retry_after_ms, const char *message);
+// Requests the provided password to be checked, and returns the id its reply
+// will carry, or 0 on errors. The password is always cleared when the
+// function returns.
+uint32_t write_comm_request(struct swaylock_password *pw);
+// Asks for a request to be dropped if the backend has not started it yet.
+bool write_comm_cancel(uint32_t id);
+bool read_comm_reply(struct comm_reply *reply);
 // FD to poll for password authentication replies.
 int get_comm_reply_fd(void);
 
@@ -6,11 +6,21 @@
  * This is an event loop system designed for sway clients, not sway itself.
  *
  * The loop consists of file descriptors and timers. Typically the Wayland
- * display's file descriptor will be one of the fds in the loop.
+ * display's file descriptor will be one of the fds in the loop. The default
+ * GLib main context can also be attached, so that D-Bus clients are serviced
+ * without a separate main loop.
  */
 
 struct loop;
 struct loop_timer;
+struct loop_wakeup;
+
+enum loop_fd_flags {
+	// Only report an fd when it becomes ready. The callback has to drain it
+	// until EAGAIN. Backends without edge triggering report it as long as
+	// it stays ready, which such callbacks handle just as well.
+	LOOP_FD_EDGE_TRIGGERED = 1 << 0,
+};
 
 /**
  * Create an event loop.
@@ -28,27 +38,93 @@ void loop_destroy(struct loop *loop);
 void loop_poll(struct loop *loop);
 
 /**
- * Add a file descriptor to the loop.
+ * Add a file descriptor to the loop. mask takes poll(2) events, and func is
+ * called with the fd, the returned events and data whenever it is ready.
+ *
+ * On Linux the fds are watched through epoll, so adding or removing one
+ * does not depend on how many there are. Elsewhere they are polled directly.
  */
 void loop_add_fd(struct loop *loop, int fd, short mask,
 		void (*func)(int fd, short mask, void *data), void *data);
 
+/**
+ * Add a file descriptor to the loop with enum loop_fd_flags.
+ */
+void loop_add_fd_flags(struct loop *loop, int fd, short mask, int flags,
+		void (*func)(int fd, short mask, void *data), void *data);
+
 /**
  * Add a timer to the loop.
  *
- * When the timer expires, the timer will be removed from the loop and freed.
+ * When the timer expires, the timer will be removed from the loop and its
+ * handle becomes invalid. Timers are kept in a heap ordered by expiry, and
+ * their nodes are recycled rather than freed.
  */
 struct loop_timer *loop_add_timer(struct loop *loop, int ms,
 		void (*callback)(void *data), void *data);
 
+/**
+ * Create a timer that stays allocated until loop_timer_destroy, and is not
+ * armed yet. Unlike the timers of loop_add_timer it can be armed again and
+ * again without allocating.
+ */
+struct loop_timer *loop_timer_create(struct loop *loop,
+		void (*callback)(void *data), void *data);
+
+/**
+ * Arm a timer from loop_timer_create to expire in delay_ms, or re-arm it if
+ * it is armed already. With a positive period_ms it then expires every
+ * period_ms until disarmed. When the loop falls behind, the missed ticks are
+ * coalesced into a single callback.
+ */
+bool loop_timer_arm(struct loop *loop, struct loop_timer *timer,
+		int delay_ms, int period_ms);
+
+/**
+ * Disarm a timer from loop_timer_create. A timer that is not armed is left
+ * alone.
+ */
+void loop_timer_disarm(struct loop *loop, struct loop_timer *timer);
+
+/**
+ * Disarm and free a timer from loop_timer_create.
+ */
+void loop_timer_destroy(struct loop *loop, struct loop_timer *timer);
+
 /**
  * Remove a file descriptor from the loop.
  */
 bool loop_remove_fd(struct loop *loop, int fd);
 
 /**
- * Remove a timer from the loop.
+ * Remove a timer of loop_add_timer from the loop. The handle must not have
+ * expired yet.
  */
 bool loop_remove_timer(struct loop *loop, struct loop_timer *timer);
 
+/**
+ * Add a wakeup to the loop. callback is called from loop_poll after
+ * loop_wakeup_signal, once for any number of signals sent before it runs.
+ */
+struct loop_wakeup *loop_add_wakeup(struct loop *loop,
+		void (*callback)(void *data), void *data);
+
+/**
+ * Wake the loop up and have the wakeup's callback called. This is safe to
+ * call from signal handlers and other threads.
+ */
+void loop_wakeup_signal(struct loop_wakeup *wakeup);
+
+/**
+ * Remove a wakeup from the loop and free it.
+ */
+void loop_remove_wakeup(struct loop_wakeup *wakeup);
+
+/**
+ * Attach the default GLib main context to the loop. Its fds and timeouts are
+ * polled together with the loop's own, and ready GLib sources are dispatched
+ * from loop_poll. The context is acquired by the calling thread.
+ */
+bool loop_add_glib_main_context(struct loop *loop);
+
 #endif
@@ -1,8 +1,16 @@
 #ifndef _SWAY_PASSWORD_BUFFER_H
 #define _SWAY_PASSWORD_BUFFER_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+// Maps and locks the arena that small password buffers are taken from, once
+// per process. Called on the first password_buffer_create otherwise.
+bool password_buffer_pool_init(void);
+// Locks the arena again in a child right after fork(), since memory locks
+// are not inherited. Children that never touch the buffers their parent took
+// from it release them, which also wipes their contents.
+bool password_buffer_pool_forked(bool release_parent_buffers);
 char *password_buffer_create(size_t size);
 void password_buffer_destroy(char *buffer, size_t size);
 
@@ -5,7 +5,23 @@
 #include <stdint.h>
 #include <wayland-client.h>
 
+struct shm_range;
+
+/**
+ * A growable wl_shm_pool that buffers are sub-allocated from. All fields zero
+ * is an empty pool; the shm file is created on the first allocation.
+ */
+struct shm_pool {
+	struct wl_shm_pool *pool;
+	int fd;
+	void *data;
+	size_t size;
+	struct shm_range *free; // free ranges sorted by offset
+};
+
 struct pool_buffer {
+	struct shm_pool *pool; // NULL if the buffer has its own shm file
+	size_t offset;
 	struct wl_buffer *buffer;
 	cairo_surface_t *surface;
 	cairo_t *cairo;
@@ -17,8 +33,17 @@ struct pool_buffer {
 
 struct pool_buffer *create_buffer(struct wl_shm *shm, struct pool_buffer *buf,
 	int32_t width, int32_t height, uint32_t format);
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
+/**
+ * Returns an idle buffer of the given size from pool, allocating it from
+ * shm_pool when possible. shm_pool may be NULL.
+ */
+struct pool_buffer *get_next_buffer(struct wl_shm *shm, struct shm_pool *shm_pool,
 	struct pool_buffer pool[static 2], uint32_t width, uint32_t height);
 void destroy_buffer(struct pool_buffer *buffer);
 
+/**
+ * Destroys the pool, every buffer allocated from it must be destroyed first.
+ */
+void shm_pool_finish(struct shm_pool *pool);
+
 #endif
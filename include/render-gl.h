@@ -0,0 +1,48 @@
+#ifndef _SWAYLOCK_RENDER_GL_H
+#define _SWAYLOCK_RENDER_GL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+#include "background-image.h"
+#include "cairo.h"
+
+struct zwp_linux_dmabuf_v1;
+
+/**
+ * Optional backend drawing backgrounds with OpenGL ES into linux-dmabuf
+ * buffers, so that images are scaled on the GPU for every frame instead of
+ * once per size on the CPU. Everything else keeps being drawn with cairo
+ * into wl_shm buffers, which are also used whenever this backend fails.
+ */
+struct swaylock_gl;
+struct gl_buffer;
+
+/**
+ * Takes over a zwp_linux_dmabuf_v1 bound at version 3, and starts collecting
+ * the buffer formats it advertises. Nothing is drawn until gl_init succeeds.
+ */
+struct swaylock_gl *gl_create(struct zwp_linux_dmabuf_v1 *dmabuf);
+
+/**
+ * Opens the render node and the EGL context, once the formats have been
+ * received. Drivers may start threads in there, so it must not be called
+ * before daemonize().
+ */
+bool gl_init(struct swaylock_gl *gl);
+
+void gl_destroy(struct swaylock_gl *gl);
+
+/**
+ * Draws the background into the next free buffer of a surface, sized
+ * width x height, and returns its wl_buffer ready to be attached. Returns
+ * NULL if the backend cannot draw it, in which case it must be drawn with
+ * cairo instead.
+ */
+struct wl_buffer *gl_render_background(struct swaylock_gl *gl,
+		struct gl_buffer *buffers[static 2], cairo_surface_t *image,
+		enum background_mode mode, uint32_t color, int width, int height);
+
+void gl_destroy_buffer(struct gl_buffer *buffer);
+
+#endif
@@ -3,6 +3,7 @@
 #include <xkbcommon/xkbcommon.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <wayland-client.h>
 
 struct loop;
 struct loop_timer;
@@ -17,6 +18,8 @@ struct swaylock_xkb {
 
 struct swaylock_seat {
 	struct swaylock_state *state;
+	struct wl_seat *wl_seat;
+	uint32_t global_name;
 	struct wl_pointer *pointer;
 	struct wl_keyboard *keyboard;
 	int32_t repeat_period_ms;
@@ -24,8 +27,11 @@ struct swaylock_seat {
 	uint32_t repeat_sym;
 	uint32_t repeat_codepoint;
 	struct loop_timer *repeat_timer;
+	struct wl_list link; // swaylock_state::seats
 };
 
 extern const struct wl_seat_listener seat_listener;
 
+void swaylock_seat_destroy(struct swaylock_seat *seat);
+
 #endif
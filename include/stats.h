@@ -0,0 +1,56 @@
+#ifndef _SWAYLOCK_STATS_H
+#define _SWAYLOCK_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Latency instrumentation, enabled with --stats. Samples are kept in
+ * log-linear histograms whose percentiles are written to stderr on SIGUSR2
+ * and at exit. Where <sys/sdt.h> is available, every sample also fires the
+ * swaylock:sample USDT probe with the histogram and the sample in ns.
+ */
+
+enum stats_histogram {
+	STATS_RENDER, // render() of one surface up to its commit
+	STATS_DRAW_BACKGROUND, // cairo drawing of a background buffer
+	STATS_DRAW_INDICATOR, // cairo drawing of an indicator buffer
+	STATS_DRAW_FINGERPRINT, // cairo drawing of a fingerprint status buffer
+	STATS_KEY_TO_COMMIT, // key press to the first commit after it
+	STATS_KEY_TO_FRAME, // key press to the frame callback of that commit
+	STATS_AUTH, // password check request to its reply
+	STATS_FINGERPRINT_START, // VerifyStart call to its reply
+	STATS_FINGERPRINT_STATUS, // verification start to VerifyStatus
+	STATS_HISTOGRAM_COUNT,
+};
+
+void stats_init(bool enabled);
+
+/**
+ * Returns the CLOCK_MONOTONIC time in ns, or 0 when stats are disabled.
+ */
+uint64_t stats_now(void);
+
+/**
+ * Records the time elapsed since start, a stats_now() value. A start of 0 is
+ * ignored, so timestamps taken while disabled are never recorded.
+ */
+void stats_record(enum stats_histogram histogram, uint64_t start);
+
+/**
+ * Notes a key press. Presses before the next commit count from the first.
+ */
+void stats_key(void);
+
+/**
+ * Notes a surface commit and returns the time of the key press it shows, to
+ * be recorded as STATS_KEY_TO_FRAME once its frame callback is done, or 0.
+ */
+uint64_t stats_commit(void);
+
+/**
+ * Writes the percentiles of all non-empty histograms to stderr.
+ */
+void stats_dump(void);
+
+#endif
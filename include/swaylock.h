@@ -3,8 +3,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <wayland-client.h>
+#include "auth.h"
 #include "background-image.h"
 #include "cairo.h"
+#include "comm.h"
 #include "pool-buffer.h"
 #include "seat.h"
 
@@ -71,6 +73,10 @@ struct swaylock_args {
 	int ready_fd;
 	bool indicator_idle_visible;
 	bool fingerprint;
+	bool image_cache;
+	bool stats;
+	bool pam_prewarm;
+	int pam_workers;
 };
 
 struct swaylock_password {
@@ -90,26 +96,54 @@ struct swaylock_state {
 	struct wl_subcompositor *subcompositor;
 	struct wl_shm *shm;
 	struct wl_list surfaces;
+	struct wl_list seats;
 	struct wl_list images;
 	struct swaylock_args args;
 	struct swaylock_password password;
 	struct swaylock_xkb xkb;
-	cairo_surface_t *test_surface;
-	cairo_t *test_cairo; // used to estimate font/text sizes
 	enum auth_state auth_state; // state of the authentication attempt
 	enum input_state input_state; // state of the password buffer and key inputs
 	uint32_t highlight_start; // position of highlight; 2048 = 1 full turn
 	int failed_attempts;
+	uint32_t auth_request_id; // newest password check in flight, 0 if none
+	uint64_t auth_request_time; // stats_now() when it was sent
+	char auth_error[COMM_MESSAGE_SIZE]; // why it failed, if not a wrong password
+	struct auth_broker auth;
 	bool run_display, locked;
+	bool defer_threads; // until daemonize(), as threads do not survive the fork
 	struct ext_session_lock_manager_v1 *ext_session_lock_manager_v1;
 	struct ext_session_lock_v1 *ext_session_lock_v1;
+	struct wp_viewporter *viewporter; // optional
+	struct wp_single_pixel_buffer_manager_v1 *single_pixel_buffer_manager; // optional
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager; // optional
+	struct swaylock_gl *gl; // optional, draws backgrounds on the GPU
 	char *fingerprint_msg;
 	char *fingerprint_driver_msg;
 	struct FingerprintState* fingerprint_state;
 };
 
+// Parts of a surface that need to be repainted
+enum surface_damage {
+	DAMAGE_BACKGROUND = 1 << 0,
+	DAMAGE_INDICATOR = 1 << 1,
+	DAMAGE_FINGERPRINT_STATUS = 1 << 2,
+	DAMAGE_ALL = DAMAGE_BACKGROUND | DAMAGE_INDICATOR | DAMAGE_FINGERPRINT_STATUS,
+};
+
+// Buffer-local rectangle, empty when width or height is 0
+struct damage_rect {
+	int x, y, width, height;
+};
+
+// Largest subsurface buffer size used at a given scale
+struct buffer_size_class {
+	int32_t scale;
+	int width, height;
+};
+
 struct swaylock_surface {
-	cairo_surface_t *image;
+	struct swaylock_image *image_source; // NULL if the output has no image
+	cairo_surface_t *image; // decoded image_source, NULL until it is ready
 	struct swaylock_state *state;
 	struct wl_output *output;
 	uint32_t output_global_name;
@@ -122,18 +156,32 @@ struct swaylock_surface {
 	struct wl_subsurface *fingerprint_subsurface;
 
 	struct ext_session_lock_surface_v1 *ext_session_lock_surface_v1;
+	struct wp_viewport *viewport; // for backgrounds not drawn at buffer scale
+	struct wp_fractional_scale_v1 *fractional_scale;
+	uint32_t preferred_scale; // of the background in 120ths, 0 if unknown
+	struct pool_buffer background_buffers[2]; // for compositor scaled images
+	struct shared_background *shared_background; // drawn background, if any
+	struct gl_buffer *gl_buffers[2]; // for GPU scaled images
+	struct pool_buffer solid_buffer; // 1x1 buffer scaled by viewport
+	struct shm_pool shm_pool; // backs the subsurface buffers
 	struct pool_buffer indicator_buffers[2];
 	struct pool_buffer fingerprint_status_buffer[2];
+	struct buffer_size_class indicator_size, fingerprint_status_size;
 	bool created;
-	bool dirty;
+	uint32_t dirty; // enum surface_damage
 	uint32_t width, height;
 	int32_t scale;
 	enum wl_output_subpixel subpixel;
 	char *output_name;
 	struct wl_list link;
 	struct wl_callback *frame;
+	uint64_t frame_key_time; // stats_commit() of the pending frame
 	// Dimensions of last wl_buffer committed to background surface
 	int last_buffer_width, last_buffer_height;
+	// Everything drawn in the last indicator frame except the highlight, and
+	// where the highlight was, so that keypresses only damage the highlight
+	uint32_t indicator_signature;
+	struct damage_rect indicator_highlight;
 };
 
 // There is exactly one swaylock_image for each -i argument
@@ -141,6 +189,7 @@ struct swaylock_image {
 	char *path;
 	char *output_name;
 	cairo_surface_t *cairo_surface;
+	bool decoding;
 	struct wl_list link;
 };
 
@@ -148,11 +197,19 @@ void swaylock_handle_key(struct swaylock_state *state,
 		xkb_keysym_t keysym, uint32_t codepoint);
 
 void render(struct swaylock_surface *surface);
+// Stops the surface from holding on to its shared background buffer
+void release_background(struct swaylock_surface *surface);
 void damage_state(struct swaylock_state *state);
+void damage_surfaces(struct swaylock_state *state, uint32_t damage);
 void clear_password_buffer(struct swaylock_password *pw);
 void schedule_auth_idle(struct swaylock_state *state);
+void decode_image(struct swaylock_state *state, struct swaylock_image *image);
+
+#define MAX_PAM_WORKERS 8
 
 void initialize_pw_backend(int argc, char **argv);
+// Called once the options are parsed, before any thread is started
+void start_pw_backend(const struct swaylock_args *args);
 void run_pw_backend_child(void);
 void clear_buffer(char *buf, size_t size);
 
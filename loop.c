@@ -1,39 +1,263 @@
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <poll.h>
 #include <time.h>
 #include <unistd.h>
-#include <wayland-client.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+#include <glib.h>
 #include "log.h"
 #include "loop.h"
 
 struct loop_fd_event {
 	void (*callback)(int fd, short mask, void *data);
 	void *data;
-	struct wl_list link; // struct loop_fd_event::link
+	int fd;
+	short mask;
+	bool removed;
+	size_t index; // position in loop::fd_events
 };
 
 struct loop_timer {
 	void (*callback)(void *data);
 	void *data;
 	struct timespec expiry;
-	bool removed;
-	struct wl_list link; // struct loop_timer::link
+	// Re-arm interval of periodic timers, zero for one-shot timers
+	struct timespec period;
+	// Owned by the caller through loop_timer_create rather than by the loop
+	bool persistent;
+	// Position in loop::timers while armed, next free node otherwise
+	size_t index;
+	struct loop_timer *next_free;
+};
+
+struct loop_wakeup {
+	struct loop *loop;
+	void (*callback)(void *data);
+	void *data;
+	// The same eventfd twice, or the two ends of a pipe
+	int fds[2];
+	// Set from the first signal until the callback runs, later signals
+	// are coalesced into that callback without another write
+	atomic_bool pending;
 };
 
 struct loop {
+	// Registered fds. fd_table maps an fd number to its event. Events removed
+	// while loop_poll is dispatching are only flagged, and freed once it is
+	// done so that pending results never point at freed memory.
+	struct loop_fd_event **fd_events;
+	size_t fd_event_count;
+	size_t fd_event_capacity;
+	struct loop_fd_event **fd_table;
+	int fd_table_size;
+	bool dispatching;
+	bool fd_events_removed;
+
+	// epoll instance watching the registered fds, or -1 to poll them directly
+	int epoll_fd;
+#ifdef __linux__
+	struct epoll_event ready[32];
+#endif
+
+	// Array handed to poll(): the registered fds, or only epoll_fd
 	struct pollfd *fds;
 	int fd_length;
 	int fd_capacity;
 
-	struct wl_list fd_events; // struct loop_fd_event::link
-	struct wl_list timers; // struct loop_timer::link
+	// Binary min-heap of armed timers ordered by expiry. Expired and removed
+	// nodes go to free_timers and are reused by the next loop_add_timer.
+	// Persistent timers are only taken out of the heap.
+	struct loop_timer **timers;
+	size_t timer_count;
+	size_t timer_capacity;
+	struct loop_timer *free_timers;
+
+	// Absolute CLOCK_MONOTONIC timer following the earliest expiry, or -1 to
+	// round the poll timeout up to whole milliseconds instead.
+	int timer_fd;
+	struct timespec timer_fd_expiry;
+
+	// GLib context polled along with the fds above, if any. Its fds are
+	// appended to fds after fd_length for every poll.
+	GMainContext *glib_context;
+	GPollFD *glib_fds;
+	int glib_fd_capacity;
 };
 
+static bool timespec_less(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void timespec_add_ms(struct timespec *ts, int ms) {
+	ts->tv_sec += ms / 1000;
+	long int nsec = (ms % 1000) * 1000000;
+	if (ts->tv_nsec + nsec >= 1000000000) {
+		ts->tv_sec++;
+		nsec -= 1000000000;
+	}
+	ts->tv_nsec += nsec;
+}
+
+static void timespec_add(struct timespec *ts, const struct timespec *add) {
+	ts->tv_sec += add->tv_sec;
+	ts->tv_nsec += add->tv_nsec;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static void timer_heap_set(struct loop *loop, size_t index,
+		struct loop_timer *timer) {
+	loop->timers[index] = timer;
+	timer->index = index;
+}
+
+static void timer_heap_sift_up(struct loop *loop, size_t index) {
+	struct loop_timer *timer = loop->timers[index];
+	while (index > 0) {
+		size_t parent = (index - 1) / 2;
+		if (!timespec_less(&timer->expiry, &loop->timers[parent]->expiry)) {
+			break;
+		}
+		timer_heap_set(loop, index, loop->timers[parent]);
+		index = parent;
+	}
+	timer_heap_set(loop, index, timer);
+}
+
+static void timer_heap_sift_down(struct loop *loop, size_t index) {
+	struct loop_timer *timer = loop->timers[index];
+	for (;;) {
+		size_t child = index * 2 + 1;
+		if (child >= loop->timer_count) {
+			break;
+		}
+		if (child + 1 < loop->timer_count &&
+				timespec_less(&loop->timers[child + 1]->expiry,
+					&loop->timers[child]->expiry)) {
+			++child;
+		}
+		if (!timespec_less(&loop->timers[child]->expiry, &timer->expiry)) {
+			break;
+		}
+		timer_heap_set(loop, index, loop->timers[child]);
+		index = child;
+	}
+	timer_heap_set(loop, index, timer);
+}
+
+static bool timer_heap_push(struct loop *loop, struct loop_timer *timer) {
+	if (loop->timer_count == loop->timer_capacity) {
+		size_t capacity = loop->timer_capacity ? loop->timer_capacity * 2 : 8;
+		struct loop_timer **timers =
+			realloc(loop->timers, sizeof(*timers) * capacity);
+		if (!timers) {
+			swaylock_log(LOG_ERROR, "Unable to allocate memory for timers");
+			return false;
+		}
+		loop->timers = timers;
+		loop->timer_capacity = capacity;
+	}
+	timer_heap_set(loop, loop->timer_count++, timer);
+	timer_heap_sift_up(loop, timer->index);
+	return true;
+}
+
+// Restores the heap order after the expiry of the timer at index changed
+static void timer_heap_update(struct loop *loop, size_t index) {
+	if (index > 0 && timespec_less(&loop->timers[index]->expiry,
+			&loop->timers[(index - 1) / 2]->expiry)) {
+		timer_heap_sift_up(loop, index);
+	} else {
+		timer_heap_sift_down(loop, index);
+	}
+}
+
+static bool timer_armed(struct loop *loop, struct loop_timer *timer) {
+	return timer->index < loop->timer_count &&
+		loop->timers[timer->index] == timer;
+}
+
+// Takes the timer out of the heap and puts its node on the free list, unless
+// the timer is persistent
+static void timer_heap_remove(struct loop *loop, struct loop_timer *timer) {
+	size_t index = timer->index;
+	struct loop_timer *last = loop->timers[--loop->timer_count];
+	timer->index = SIZE_MAX;
+	if (last != timer) {
+		timer_heap_set(loop, index, last);
+		timer_heap_update(loop, index);
+	}
+	if (timer->persistent) {
+		return;
+	}
+	timer->callback = NULL;
+	timer->data = NULL;
+	timer->next_free = loop->free_timers;
+	loop->free_timers = timer;
+}
+
+static void loop_timer_fd_read(int fd, short mask, void *data) {
+	// Only clears readiness, expired timers are dispatched by loop_poll
+	uint64_t expirations;
+	(void)read(fd, &expirations, sizeof(expirations));
+}
+
+// Returns the poll timeout in ms needed to wake up for the earliest timer
+static int loop_arm_timers(struct loop *loop) {
+	if (loop->timer_fd >= 0) {
+#ifdef __linux__
+		struct itimerspec spec = {0};
+		if (loop->timer_count > 0) {
+			spec.it_value = loop->timers[0]->expiry;
+		}
+		if (spec.it_value.tv_sec != loop->timer_fd_expiry.tv_sec ||
+				spec.it_value.tv_nsec != loop->timer_fd_expiry.tv_nsec) {
+			if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME,
+					&spec, NULL) == 0) {
+				loop->timer_fd_expiry = spec.it_value;
+				return INT_MAX;
+			}
+			swaylock_log_errno(LOG_ERROR, "timerfd_settime failed");
+			loop_remove_fd(loop, loop->timer_fd);
+			close(loop->timer_fd);
+			loop->timer_fd = -1;
+		} else {
+			return INT_MAX;
+		}
+#endif
+	}
+
+	if (loop->timer_count == 0) {
+		return INT_MAX;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct timespec *expiry = &loop->timers[0]->expiry;
+	if (!timespec_less(&now, expiry)) {
+		return 0;
+	}
+	// Round up, waking early would only spin until the deadline
+	long long ns = (expiry->tv_sec - now.tv_sec) * 1000000000LL +
+		(expiry->tv_nsec - now.tv_nsec);
+	long long ms = (ns + 999999) / 1000000;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
 struct loop *loop_create(void) {
 	struct loop *loop = calloc(1, sizeof(struct loop));
 	if (!loop) {
@@ -42,93 +266,335 @@ struct loop *loop_create(void) {
 	}
 	loop->fd_capacity = 10;
 	loop->fds = malloc(sizeof(struct pollfd) * loop->fd_capacity);
-	wl_list_init(&loop->fd_events);
-	wl_list_init(&loop->timers);
+
+	loop->epoll_fd = -1;
+	loop->timer_fd = -1;
+#ifdef __linux__
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		swaylock_log_errno(LOG_DEBUG, "epoll_create1 failed, "
+			"falling back to poll");
+	}
+
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+		TFD_NONBLOCK | TFD_CLOEXEC);
+	if (loop->timer_fd < 0) {
+		swaylock_log_errno(LOG_DEBUG, "timerfd_create failed, "
+			"falling back to poll timeouts");
+	} else {
+		loop_add_fd(loop, loop->timer_fd, POLLIN, loop_timer_fd_read, NULL);
+	}
+#endif
 	return loop;
 }
 
 void loop_destroy(struct loop *loop) {
-	struct loop_fd_event *event = NULL, *tmp_event = NULL;
-	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
-		wl_list_remove(&event->link);
-		free(event);
-	}
-	struct loop_timer *timer = NULL, *tmp_timer = NULL;
-	wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
-		wl_list_remove(&timer->link);
+	for (size_t i = 0; i < loop->fd_event_count; ++i) {
+		free(loop->fd_events[i]);
+	}
+	free(loop->fd_events);
+	free(loop->fd_table);
+	if (loop->epoll_fd >= 0) {
+		close(loop->epoll_fd);
+	}
+	for (size_t i = 0; i < loop->timer_count; ++i) {
+		if (loop->timers[i]->persistent) {
+			loop->timers[i]->index = SIZE_MAX;
+		} else {
+			free(loop->timers[i]);
+		}
+	}
+	free(loop->timers);
+	while (loop->free_timers) {
+		struct loop_timer *timer = loop->free_timers;
+		loop->free_timers = timer->next_free;
 		free(timer);
 	}
+	if (loop->timer_fd >= 0) {
+		close(loop->timer_fd);
+	}
+	if (loop->glib_context) {
+		g_main_context_release(loop->glib_context);
+		g_main_context_unref(loop->glib_context);
+	}
+	free(loop->glib_fds);
 	free(loop->fds);
 	free(loop);
 }
 
-void loop_poll(struct loop *loop) {
-	// Calculate next timer in ms
-	int ms = INT_MAX;
-	if (!wl_list_empty(&loop->timers)) {
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		struct loop_timer *timer = NULL;
-		wl_list_for_each(timer, &loop->timers, link) {
-			int timer_ms = (timer->expiry.tv_sec - now.tv_sec) * 1000;
-			timer_ms += (timer->expiry.tv_nsec - now.tv_nsec) / 1000000;
-			if (timer_ms < ms) {
-				ms = timer_ms;
-			}
+static bool loop_reserve_fds(struct loop *loop, int length) {
+	if (length <= loop->fd_capacity) {
+		return true;
+	}
+	int capacity = loop->fd_capacity;
+	while (capacity < length) {
+		capacity += 10;
+	}
+	struct pollfd *fds = realloc(loop->fds, sizeof(struct pollfd) * capacity);
+	if (!fds) {
+		swaylock_log(LOG_ERROR, "Unable to allocate memory for pollfds");
+		return false;
+	}
+	loop->fds = fds;
+	loop->fd_capacity = capacity;
+	return true;
+}
+
+#ifdef __linux__
+static uint32_t poll_to_epoll(short mask) {
+	uint32_t events = 0;
+	if (mask & POLLIN) {
+		events |= EPOLLIN;
+	}
+	if (mask & POLLPRI) {
+		events |= EPOLLPRI;
+	}
+	if (mask & POLLOUT) {
+		events |= EPOLLOUT;
+	}
+	return events;
+}
+
+static short epoll_to_poll(uint32_t events) {
+	short mask = 0;
+	if (events & EPOLLIN) {
+		mask |= POLLIN;
+	}
+	if (events & EPOLLPRI) {
+		mask |= POLLPRI;
+	}
+	if (events & EPOLLOUT) {
+		mask |= POLLOUT;
+	}
+	if (events & EPOLLHUP) {
+		mask |= POLLHUP;
+	}
+	if (events & EPOLLERR) {
+		mask |= POLLERR;
+	}
+	return mask;
+}
+#endif
+
+// Fills fds with what poll() has to watch besides the GLib fds
+static void loop_prepare_fds(struct loop *loop) {
+	if (loop->epoll_fd >= 0) {
+		struct pollfd pfd = {loop->epoll_fd, POLLIN, 0};
+		loop->fds[0] = pfd;
+		loop->fd_length = 1;
+		return;
+	}
+	if (!loop_reserve_fds(loop, loop->fd_event_count)) {
+		exit(1);
+	}
+	for (size_t i = 0; i < loop->fd_event_count; ++i) {
+		struct loop_fd_event *event = loop->fd_events[i];
+		struct pollfd pfd = {event->fd, event->mask, 0};
+		loop->fds[i] = pfd;
+	}
+	loop->fd_length = loop->fd_event_count;
+}
+
+static void loop_sweep_fd_events(struct loop *loop) {
+	size_t count = 0;
+	for (size_t i = 0; i < loop->fd_event_count; ++i) {
+		struct loop_fd_event *event = loop->fd_events[i];
+		if (event->removed) {
+			free(event);
+			continue;
 		}
+		event->index = count;
+		loop->fd_events[count++] = event;
 	}
-	if (ms < 0) {
-		ms = 0;
+	loop->fd_event_count = count;
+	loop->fd_events_removed = false;
+}
+
+// Appends the GLib fds after the loop's own and lowers ms to the GLib timeout.
+// Returns the number of GLib fds to poll.
+static int loop_glib_prepare(struct loop *loop, int *max_priority, int *ms) {
+	if (g_main_context_prepare(loop->glib_context, max_priority)) {
+		*ms = 0;
+	}
+
+	int timeout;
+	int n;
+	while ((n = g_main_context_query(loop->glib_context, *max_priority,
+			&timeout, loop->glib_fds, loop->glib_fd_capacity)) >
+			loop->glib_fd_capacity) {
+		GPollFD *fds = realloc(loop->glib_fds, sizeof(GPollFD) * n);
+		if (!fds) {
+			swaylock_log(LOG_ERROR, "Unable to allocate memory for GLib fds");
+			exit(1);
+		}
+		loop->glib_fds = fds;
+		loop->glib_fd_capacity = n;
+	}
+	if (timeout >= 0 && timeout < *ms) {
+		*ms = timeout;
 	}
 
-	int ret = poll(loop->fds, loop->fd_length, ms);
-	if (ret < 0 && errno != EINTR) {
-		swaylock_log_errno(LOG_ERROR, "poll failed");
+	if (!loop_reserve_fds(loop, loop->fd_length + n)) {
 		exit(1);
 	}
+	for (int i = 0; i < n; ++i) {
+		struct pollfd pfd = {loop->glib_fds[i].fd, loop->glib_fds[i].events, 0};
+		loop->fds[loop->fd_length + i] = pfd;
+	}
+	return n;
+}
 
-	// Dispatch fds
-	size_t fd_index = 0;
-	struct loop_fd_event *event = NULL;
-	wl_list_for_each(event, &loop->fd_events, link) {
-		struct pollfd pfd = loop->fds[fd_index];
+void loop_poll(struct loop *loop) {
+	int ms = loop_arm_timers(loop);
 
-		// Always send these events
-		unsigned events = pfd.events | POLLHUP | POLLERR;
+	loop_prepare_fds(loop);
+	int fd_length = loop->fd_length;
 
-		if (pfd.revents & events) {
-			event->callback(pfd.fd, pfd.revents, event->data);
+	int glib_max_priority = 0;
+	int glib_fd_length = 0;
+	if (loop->glib_context) {
+		glib_fd_length = loop_glib_prepare(loop, &glib_max_priority, &ms);
+	}
+
+	int ready = 0;
+	bool epoll_ready = loop->epoll_fd >= 0;
+	if (!epoll_ready || glib_fd_length > 0) {
+		// The epoll fd becomes readable when any registered fd is ready
+		int ret = poll(loop->fds, fd_length + glib_fd_length, ms);
+		if (ret < 0 && errno != EINTR) {
+			swaylock_log_errno(LOG_ERROR, "poll failed");
+			exit(1);
+		}
+		epoll_ready = epoll_ready && ret > 0 && loop->fds[0].revents;
+		ms = 0;
+	}
+#ifdef __linux__
+	if (epoll_ready) {
+		ready = epoll_wait(loop->epoll_fd, loop->ready,
+			sizeof(loop->ready) / sizeof(loop->ready[0]), ms);
+		if (ready < 0) {
+			if (errno != EINTR) {
+				swaylock_log_errno(LOG_ERROR, "epoll_wait failed");
+				exit(1);
+			}
+			ready = 0;
 		}
+	}
+#endif
 
-		++fd_index;
+	// Hand the results back before any callback can touch loop->fds
+	for (int i = 0; i < glib_fd_length; ++i) {
+		loop->glib_fds[i].revents = loop->fds[fd_length + i].revents;
 	}
 
-	// Dispatch timers
-	if (!wl_list_empty(&loop->timers)) {
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		struct loop_timer *timer = NULL, *tmp_timer = NULL;
-		wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
-			if (timer->removed) {
-				wl_list_remove(&timer->link);
-				free(timer);
-				continue;
+	loop->dispatching = true;
+
+	// Dispatch fds
+	if (loop->epoll_fd < 0) {
+		for (int i = 0; i < fd_length; ++i) {
+			struct loop_fd_event *event = loop->fd_events[i];
+			struct pollfd pfd = loop->fds[i];
+
+			// Always send these events
+			unsigned events = pfd.events | POLLHUP | POLLERR;
+
+			if (!event->removed && (pfd.revents & events)) {
+				event->callback(pfd.fd, pfd.revents, event->data);
 			}
+		}
+	}
+#ifdef __linux__
+	for (int i = 0; i < ready; ++i) {
+		struct loop_fd_event *event = loop->ready[i].data.ptr;
+		if (!event->removed) {
+			event->callback(event->fd,
+				epoll_to_poll(loop->ready[i].events), event->data);
+		}
+	}
+#endif
 
-			bool expired = timer->expiry.tv_sec < now.tv_sec ||
-				(timer->expiry.tv_sec == now.tv_sec &&
-				 timer->expiry.tv_nsec < now.tv_nsec);
-			if (expired) {
-				timer->callback(timer->data);
-				wl_list_remove(&timer->link);
-				free(timer);
+	// Dispatch timers. Timers added by the callbacks expire after now, so
+	// they wait for the next iteration.
+	if (loop->timer_count > 0) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while (loop->timer_count > 0 &&
+				!timespec_less(&now, &loop->timers[0]->expiry)) {
+			struct loop_timer *timer = loop->timers[0];
+			void (*callback)(void *data) = timer->callback;
+			void *data = timer->data;
+			if (timer->period.tv_sec != 0 || timer->period.tv_nsec != 0) {
+				// Ticks missed while the loop was busy are coalesced
+				// into this one, and the next follows a period later
+				timespec_add(&timer->expiry, &timer->period);
+				if (!timespec_less(&now, &timer->expiry)) {
+					timer->expiry = now;
+					timespec_add(&timer->expiry, &timer->period);
+				}
+				timer_heap_sift_down(loop, 0);
+			} else {
+				timer_heap_remove(loop, timer);
 			}
+			callback(data);
 		}
 	}
+
+	// Dispatch GLib sources
+	if (loop->glib_context && g_main_context_check(loop->glib_context,
+			glib_max_priority, loop->glib_fds, glib_fd_length)) {
+		g_main_context_dispatch(loop->glib_context);
+	}
+
+	loop->dispatching = false;
+	if (loop->fd_events_removed) {
+		loop_sweep_fd_events(loop);
+	}
 }
 
 void loop_add_fd(struct loop *loop, int fd, short mask,
 		void (*callback)(int fd, short mask, void *data), void *data) {
+	loop_add_fd_flags(loop, fd, mask, 0, callback, data);
+}
+
+void loop_add_fd_flags(struct loop *loop, int fd, short mask, int flags,
+		void (*callback)(int fd, short mask, void *data), void *data) {
+	if (fd < 0) {
+		return;
+	}
+	if (fd < loop->fd_table_size && loop->fd_table[fd]) {
+		swaylock_log(LOG_ERROR, "fd %d is already in the loop", fd);
+		return;
+	}
+
+	if (fd >= loop->fd_table_size) {
+		int size = loop->fd_table_size ? loop->fd_table_size : 16;
+		while (size <= fd) {
+			size *= 2;
+		}
+		struct loop_fd_event **table =
+			realloc(loop->fd_table, sizeof(*table) * size);
+		if (!table) {
+			swaylock_log(LOG_ERROR, "Unable to allocate memory for fd table");
+			return;
+		}
+		memset(&table[loop->fd_table_size], 0,
+			sizeof(*table) * (size - loop->fd_table_size));
+		loop->fd_table = table;
+		loop->fd_table_size = size;
+	}
+	if (loop->fd_event_count == loop->fd_event_capacity) {
+		size_t capacity = loop->fd_event_capacity ?
+			loop->fd_event_capacity * 2 : 8;
+		struct loop_fd_event **events =
+			realloc(loop->fd_events, sizeof(*events) * capacity);
+		if (!events) {
+			swaylock_log(LOG_ERROR, "Unable to allocate memory for events");
+			return;
+		}
+		loop->fd_events = events;
+		loop->fd_event_capacity = capacity;
+	}
+
 	struct loop_fd_event *event = calloc(1, sizeof(struct loop_fd_event));
 	if (!event) {
 		swaylock_log(LOG_ERROR, "Unable to allocate memory for event");
@@ -136,21 +602,62 @@ void loop_add_fd(struct loop *loop, int fd, short mask,
 	}
 	event->callback = callback;
 	event->data = data;
-	wl_list_insert(loop->fd_events.prev, &event->link);
+	event->fd = fd;
+	event->mask = mask;
 
-	struct pollfd pfd = {fd, mask, 0};
-
-	if (loop->fd_length == loop->fd_capacity) {
-		loop->fd_capacity += 10;
-		loop->fds = realloc(loop->fds,
-				sizeof(struct pollfd) * loop->fd_capacity);
+#ifdef __linux__
+	if (loop->epoll_fd >= 0) {
+		struct epoll_event ev = {
+			.events = poll_to_epoll(mask),
+			.data.ptr = event,
+		};
+		if (flags & LOOP_FD_EDGE_TRIGGERED) {
+			ev.events |= EPOLLET;
+		}
+		if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			swaylock_log_errno(LOG_ERROR, "Unable to add fd %d to epoll", fd);
+			free(event);
+			return;
+		}
 	}
+#endif
 
-	loop->fds[loop->fd_length++] = pfd;
+	event->index = loop->fd_event_count;
+	loop->fd_events[loop->fd_event_count++] = event;
+	loop->fd_table[fd] = event;
 }
 
 struct loop_timer *loop_add_timer(struct loop *loop, int ms,
 		void (*callback)(void *data), void *data) {
+	struct loop_timer *timer = loop->free_timers;
+	if (timer) {
+		loop->free_timers = timer->next_free;
+		timer->next_free = NULL;
+	} else {
+		timer = calloc(1, sizeof(struct loop_timer));
+		if (!timer) {
+			swaylock_log(LOG_ERROR, "Unable to allocate memory for timer");
+			return NULL;
+		}
+	}
+	timer->callback = callback;
+	timer->data = data;
+	timer->period.tv_sec = 0;
+	timer->period.tv_nsec = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &timer->expiry);
+	timespec_add_ms(&timer->expiry, ms);
+
+	if (!timer_heap_push(loop, timer)) {
+		timer->next_free = loop->free_timers;
+		loop->free_timers = timer;
+		return NULL;
+	}
+	return timer;
+}
+
+struct loop_timer *loop_timer_create(struct loop *loop,
+		void (*callback)(void *data), void *data) {
 	struct loop_timer *timer = calloc(1, sizeof(struct loop_timer));
 	if (!timer) {
 		swaylock_log(LOG_ERROR, "Unable to allocate memory for timer");
@@ -158,47 +665,152 @@ struct loop_timer *loop_add_timer(struct loop *loop, int ms,
 	}
 	timer->callback = callback;
 	timer->data = data;
+	timer->persistent = true;
+	timer->index = SIZE_MAX;
+	return timer;
+}
 
+bool loop_timer_arm(struct loop *loop, struct loop_timer *timer,
+		int delay_ms, int period_ms) {
 	clock_gettime(CLOCK_MONOTONIC, &timer->expiry);
-	timer->expiry.tv_sec += ms / 1000;
+	timespec_add_ms(&timer->expiry, delay_ms);
+	timer->period.tv_sec = 0;
+	timer->period.tv_nsec = 0;
+	if (period_ms > 0) {
+		timespec_add_ms(&timer->period, period_ms);
+	}
 
-	long int nsec = (ms % 1000) * 1000000;
-	if (timer->expiry.tv_nsec + nsec >= 1000000000) {
-		timer->expiry.tv_sec++;
-		nsec -= 1000000000;
+	if (timer_armed(loop, timer)) {
+		timer_heap_update(loop, timer->index);
+		return true;
 	}
-	timer->expiry.tv_nsec += nsec;
+	return timer_heap_push(loop, timer);
+}
 
-	wl_list_insert(&loop->timers, &timer->link);
+void loop_timer_disarm(struct loop *loop, struct loop_timer *timer) {
+	if (timer_armed(loop, timer)) {
+		timer_heap_remove(loop, timer);
+	}
+}
 
-	return timer;
+void loop_timer_destroy(struct loop *loop, struct loop_timer *timer) {
+	if (!timer) {
+		return;
+	}
+	loop_timer_disarm(loop, timer);
+	free(timer);
 }
 
 bool loop_remove_fd(struct loop *loop, int fd) {
-	size_t fd_index = 0;
-	struct loop_fd_event *event = NULL, *tmp_event = NULL;
-	wl_list_for_each_safe(event, tmp_event, &loop->fd_events, link) {
-		if (loop->fds[fd_index].fd == fd) {
-			wl_list_remove(&event->link);
-			free(event);
+	if (fd < 0 || fd >= loop->fd_table_size || !loop->fd_table[fd]) {
+		return false;
+	}
+	struct loop_fd_event *event = loop->fd_table[fd];
+	loop->fd_table[fd] = NULL;
 
-			loop->fd_length--;
-			memmove(&loop->fds[fd_index], &loop->fds[fd_index + 1],
-					sizeof(struct pollfd) * (loop->fd_length - fd_index));
-			return true;
+#ifdef __linux__
+	if (loop->epoll_fd >= 0) {
+		// Fails harmlessly if the fd was already closed
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	}
+#endif
+
+	if (loop->dispatching) {
+		event->removed = true;
+		loop->fd_events_removed = true;
+		return true;
+	}
+	struct loop_fd_event *last = loop->fd_events[--loop->fd_event_count];
+	last->index = event->index;
+	loop->fd_events[event->index] = last;
+	free(event);
+	return true;
+}
+
+bool loop_remove_timer(struct loop *loop, struct loop_timer *timer) {
+	if (timer->persistent || !timer_armed(loop, timer)) {
+		return false;
+	}
+	timer_heap_remove(loop, timer);
+	return true;
+}
+
+bool loop_add_glib_main_context(struct loop *loop) {
+	if (loop->glib_context) {
+		return true;
+	}
+	GMainContext *context = g_main_context_default();
+	if (!g_main_context_acquire(context)) {
+		swaylock_log(LOG_ERROR, "Unable to acquire the GLib main context");
+		return false;
+	}
+	loop->glib_context = g_main_context_ref(context);
+	return true;
+}
+
+static void loop_wakeup_read(int fd, short mask, void *data) {
+	struct loop_wakeup *wakeup = data;
+	// Clear pending first, so a signal racing with the read below is
+	// either drained here or triggers another callback
+	atomic_store(&wakeup->pending, false);
+	uint64_t buf[4];
+	while (read(fd, buf, sizeof(buf)) > 0) {
+		if (wakeup->fds[0] == wakeup->fds[1]) {
+			break;
 		}
-		++fd_index;
 	}
-	return false;
+	wakeup->callback(wakeup->data);
 }
 
-bool loop_remove_timer(struct loop *loop, struct loop_timer *remove) {
-	struct loop_timer *timer = NULL, *tmp_timer = NULL;
-	wl_list_for_each_safe(timer, tmp_timer, &loop->timers, link) {
-		if (timer == remove) {
-			timer->removed = true;
-			return true;
+struct loop_wakeup *loop_add_wakeup(struct loop *loop,
+		void (*callback)(void *data), void *data) {
+	struct loop_wakeup *wakeup = calloc(1, sizeof(struct loop_wakeup));
+	if (!wakeup) {
+		swaylock_log(LOG_ERROR, "Unable to allocate memory for wakeup");
+		return NULL;
+	}
+	wakeup->loop = loop;
+	wakeup->callback = callback;
+	wakeup->data = data;
+	atomic_init(&wakeup->pending, false);
+
+#ifdef __linux__
+	int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd >= 0) {
+		wakeup->fds[0] = wakeup->fds[1] = fd;
+	} else
+#endif
+	{
+		if (pipe(wakeup->fds) != 0) {
+			swaylock_log_errno(LOG_ERROR, "Unable to create wakeup pipe");
+			free(wakeup);
+			return NULL;
 		}
+		for (int i = 0; i < 2; ++i) {
+			fcntl(wakeup->fds[i], F_SETFD, FD_CLOEXEC);
+			fcntl(wakeup->fds[i], F_SETFL, O_NONBLOCK);
+		}
+	}
+
+	loop_add_fd(loop, wakeup->fds[0], POLLIN, loop_wakeup_read, wakeup);
+	return wakeup;
+}
+
+void loop_wakeup_signal(struct loop_wakeup *wakeup) {
+	if (atomic_exchange(&wakeup->pending, true)) {
+		return;
+	}
+	int saved_errno = errno;
+	uint64_t one = 1;
+	(void)write(wakeup->fds[1], &one, sizeof(one));
+	errno = saved_errno;
+}
+
+void loop_remove_wakeup(struct loop_wakeup *wakeup) {
+	loop_remove_fd(wakeup->loop, wakeup->fds[0]);
+	close(wakeup->fds[0]);
+	if (wakeup->fds[1] != wakeup->fds[0]) {
+		close(wakeup->fds[1]);
 	}
-	return false;
+	free(wakeup);
 }
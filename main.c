@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <wayland-client.h>
 #include <wordexp.h>
+#include <gio/gio.h>
 #include "background-image.h"
 #include "cairo.h"
 #include "comm.h"
@@ -24,8 +25,16 @@
 #include "password-buffer.h"
 #include "pool-buffer.h"
 #include "seat.h"
+#include "stats.h"
 #include "swaylock.h"
 #include "ext-session-lock-v1-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
+#if HAVE_GL
+#include "linux-dmabuf-v1-client-protocol.h"
+#include "render-gl.h"
+#endif
 #include "fingerprint/fingerprint.h"
 
 static uint32_t parse_color(const char *color)
@@ -70,6 +79,19 @@ int lenient_strcmp(char *a, char *b)
 	}
 }
 
+#if HAVE_GL
+// Without the GPU path every background is drawn with cairo
+static void init_gl(struct swaylock_state *state)
+{
+	if (state->gl && !gl_init(state->gl))
+	{
+		swaylock_log(LOG_INFO, "Drawing backgrounds on the CPU");
+		gl_destroy(state->gl);
+		state->gl = NULL;
+	}
+}
+#endif
+
 static void daemonize(void)
 {
 	int fds[2];
@@ -80,6 +102,8 @@ static void daemonize(void)
 	}
 	if (fork() == 0)
 	{
+		// The password buffer of the state lives on in the child
+		password_buffer_pool_forked(false);
 		setsid();
 		close(fds[0]);
 		int devnull = open("/dev/null", O_RDWR);
@@ -136,20 +160,41 @@ static void destroy_surface(struct swaylock_surface *surface)
 	{
 		wl_surface_destroy(surface->fingerprint_status);
 	}
+	if (surface->viewport)
+	{
+		wp_viewport_destroy(surface->viewport);
+	}
+	if (surface->fractional_scale)
+	{
+		wp_fractional_scale_v1_destroy(surface->fractional_scale);
+	}
 	if (surface->surface != NULL)
 	{
 		wl_surface_destroy(surface->surface);
 	}
+	release_background(surface);
+#if HAVE_GL
+	gl_destroy_buffer(surface->gl_buffers[0]);
+	gl_destroy_buffer(surface->gl_buffers[1]);
+#endif
+	destroy_buffer(&surface->background_buffers[0]);
+	destroy_buffer(&surface->background_buffers[1]);
+	destroy_buffer(&surface->solid_buffer);
 	destroy_buffer(&surface->indicator_buffers[0]);
 	destroy_buffer(&surface->indicator_buffers[1]);
+	destroy_buffer(&surface->fingerprint_status_buffer[0]);
+	destroy_buffer(&surface->fingerprint_status_buffer[1]);
+	shm_pool_finish(&surface->shm_pool);
 	wl_output_release(surface->output);
 	free(surface);
 }
 
 static const struct ext_session_lock_surface_v1_listener ext_session_lock_surface_v1_listener;
 
-static cairo_surface_t *select_image(struct swaylock_state *state,
-									 struct swaylock_surface *surface);
+static struct swaylock_image *select_image(struct swaylock_state *state,
+											struct swaylock_surface *surface);
+
+static void update_opaque_region(struct swaylock_surface *surface);
 
 static bool surface_is_opaque(struct swaylock_surface *surface)
 {
@@ -160,15 +205,45 @@ static bool surface_is_opaque(struct swaylock_surface *surface)
 	return (surface->state->args.colors.background & 0xff) == 0xff;
 }
 
+static void handle_preferred_scale(void *data,
+								   struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale)
+{
+	struct swaylock_surface *surface = data;
+	if (surface->preferred_scale == scale)
+	{
+		return;
+	}
+	surface->preferred_scale = scale;
+	if (surface->state->run_display)
+	{
+		surface->dirty |= DAMAGE_BACKGROUND;
+		render(surface);
+	}
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	.preferred_scale = handle_preferred_scale,
+};
+
 static void create_surface(struct swaylock_surface *surface)
 {
 	struct swaylock_state *state = surface->state;
 
-	surface->image = select_image(state, surface);
+	surface->image_source = select_image(state, surface);
+	surface->image = surface->image_source ? surface->image_source->cairo_surface : NULL;
 
 	surface->surface = wl_compositor_create_surface(state->compositor);
 	assert(surface->surface);
 
+	// The background can only be sized exactly when it can be scaled back
+	if (state->fractional_scale_manager && state->viewporter)
+	{
+		surface->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+			state->fractional_scale_manager, surface->surface);
+		wp_fractional_scale_v1_add_listener(surface->fractional_scale,
+											&fractional_scale_listener, surface);
+	}
+
 	surface->child = wl_compositor_create_surface(state->compositor);
 	assert(surface->child);
 
@@ -188,16 +263,7 @@ static void create_surface(struct swaylock_surface *surface)
 	ext_session_lock_surface_v1_add_listener(surface->ext_session_lock_surface_v1,
 											 &ext_session_lock_surface_v1_listener, surface);
 
-	if (surface_is_opaque(surface) &&
-		surface->state->args.mode != BACKGROUND_MODE_CENTER &&
-		surface->state->args.mode != BACKGROUND_MODE_FIT)
-	{
-		struct wl_region *region =
-			wl_compositor_create_region(surface->state->compositor);
-		wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
-		wl_surface_set_opaque_region(surface->surface, region);
-		wl_region_destroy(region);
-	}
+	update_opaque_region(surface);
 
 	surface->created = true;
 }
@@ -210,7 +276,7 @@ static void ext_session_lock_surface_v1_handle_configure(void *data,
 	surface->width = width;
 	surface->height = height;
 	ext_session_lock_surface_v1_ack_configure(lock_surface, serial);
-	surface->dirty = true;
+	surface->dirty |= DAMAGE_ALL;
 	render(surface);
 }
 
@@ -218,16 +284,22 @@ static const struct ext_session_lock_surface_v1_listener ext_session_lock_surfac
 	.configure = ext_session_lock_surface_v1_handle_configure,
 };
 
-void damage_state(struct swaylock_state *state)
+void damage_surfaces(struct swaylock_state *state, uint32_t damage)
 {
 	struct swaylock_surface *surface;
 	wl_list_for_each(surface, &state->surfaces, link)
 	{
-		surface->dirty = true;
+		surface->dirty |= damage;
 		render(surface);
 	}
 }
 
+// The indicator is the only part that depends on the input and auth states
+void damage_state(struct swaylock_state *state)
+{
+	damage_surfaces(state, DAMAGE_INDICATOR);
+}
+
 static void handle_wl_output_geometry(void *data, struct wl_output *wl_output,
 									  int32_t x, int32_t y, int32_t width_mm, int32_t height_mm,
 									  int32_t subpixel, const char *make, const char *model,
@@ -237,7 +309,7 @@ static void handle_wl_output_geometry(void *data, struct wl_output *wl_output,
 	surface->subpixel = subpixel;
 	if (surface->state->run_display)
 	{
-		surface->dirty = true;
+		surface->dirty |= DAMAGE_INDICATOR | DAMAGE_FINGERPRINT_STATUS;
 		render(surface);
 	}
 }
@@ -264,7 +336,7 @@ static void handle_wl_output_scale(void *data, struct wl_output *output,
 	surface->scale = factor;
 	if (surface->state->run_display)
 	{
-		surface->dirty = true;
+		surface->dirty |= DAMAGE_ALL;
 		render(surface);
 	}
 }
@@ -335,6 +407,9 @@ static void handle_global(void *data, struct wl_registry *registry,
 		struct swaylock_seat *swaylock_seat =
 			calloc(1, sizeof(struct swaylock_seat));
 		swaylock_seat->state = state;
+		swaylock_seat->wl_seat = seat;
+		swaylock_seat->global_name = name;
+		wl_list_insert(&state->seats, &swaylock_seat->link);
 		wl_seat_add_listener(seat, &seat_listener, swaylock_seat);
 	}
 	else if (strcmp(interface, wl_output_interface.name) == 0)
@@ -353,6 +428,29 @@ static void handle_global(void *data, struct wl_registry *registry,
 		state->ext_session_lock_manager_v1 = wl_registry_bind(registry, name,
 															  &ext_session_lock_manager_v1_interface, 1);
 	}
+	else if (strcmp(interface, wp_viewporter_interface.name) == 0)
+	{
+		state->viewporter = wl_registry_bind(registry, name,
+											 &wp_viewporter_interface, 1);
+	}
+	else if (strcmp(interface, wp_single_pixel_buffer_manager_v1_interface.name) == 0)
+	{
+		state->single_pixel_buffer_manager = wl_registry_bind(registry, name,
+															  &wp_single_pixel_buffer_manager_v1_interface, 1);
+	}
+	else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0)
+	{
+		state->fractional_scale_manager = wl_registry_bind(registry, name,
+														   &wp_fractional_scale_manager_v1_interface, 1);
+	}
+#if HAVE_GL
+	else if (strcmp(interface, zwp_linux_dmabuf_v1_interface.name) == 0 &&
+			 version >= 3)
+	{
+		state->gl = gl_create(wl_registry_bind(registry, name,
+											   &zwp_linux_dmabuf_v1_interface, 3));
+	}
+#endif
 }
 
 static void handle_global_remove(void *data, struct wl_registry *registry,
@@ -365,7 +463,16 @@ static void handle_global_remove(void *data, struct wl_registry *registry,
 		if (surface->output_global_name == name)
 		{
 			destroy_surface(surface);
-			break;
+			return;
+		}
+	}
+	struct swaylock_seat *seat;
+	wl_list_for_each(seat, &state->seats, link)
+	{
+		if (seat->global_name == name)
+		{
+			swaylock_seat_destroy(seat);
+			return;
 		}
 	}
 }
@@ -375,27 +482,34 @@ static const struct wl_registry_listener registry_listener = {
 	.global_remove = handle_global_remove,
 };
 
-static int sigusr_fds[2] = {-1, -1};
+static struct loop_wakeup *sigusr_wakeup = NULL;
 
 void do_sigusr(int sig)
 {
-	(void)write(sigusr_fds[1], "1", 1);
+	loop_wakeup_signal(sigusr_wakeup);
 }
 
-static cairo_surface_t *select_image(struct swaylock_state *state,
-									 struct swaylock_surface *surface)
+static struct loop_wakeup *stats_wakeup = NULL;
+
+static void do_sigusr2(int sig)
+{
+	loop_wakeup_signal(stats_wakeup);
+}
+
+static struct swaylock_image *select_image(struct swaylock_state *state,
+											struct swaylock_surface *surface)
 {
 	struct swaylock_image *image;
-	cairo_surface_t *default_image = NULL;
+	struct swaylock_image *default_image = NULL;
 	wl_list_for_each(image, &state->images, link)
 	{
 		if (lenient_strcmp(image->output_name, surface->output_name) == 0)
 		{
-			return image->cairo_surface;
+			return image;
 		}
 		else if (!image->output_name)
 		{
-			default_image = image->cairo_surface;
+			default_image = image;
 		}
 	}
 	return default_image;
@@ -481,16 +595,117 @@ static void load_image(char *arg, struct swaylock_state *state)
 		wordfree(&p);
 	}
 
-	// Load the actual image
-	image->cairo_surface = load_background_image(image->path);
+	// The image itself is decoded later by load_images
+	wl_list_insert(&state->images, &image->link);
+}
+
+static void update_opaque_region(struct swaylock_surface *surface)
+{
+	if (surface_is_opaque(surface) &&
+		surface->state->args.mode != BACKGROUND_MODE_CENTER &&
+		surface->state->args.mode != BACKGROUND_MODE_FIT)
+	{
+		struct wl_region *region =
+			wl_compositor_create_region(surface->state->compositor);
+		wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
+		wl_surface_set_opaque_region(surface->surface, region);
+		wl_region_destroy(region);
+	}
+	else
+	{
+		wl_surface_set_opaque_region(surface->surface, NULL);
+	}
+}
+
+static void update_surface_image(struct swaylock_surface *surface)
+{
+	struct swaylock_image *source = select_image(surface->state, surface);
+	cairo_surface_t *image = source ? source->cairo_surface : NULL;
+	if (source == surface->image_source && image == surface->image)
+	{
+		return;
+	}
+	surface->image_source = source;
+	surface->image = image;
+	if (!surface->created)
+	{
+		return;
+	}
+
+	update_opaque_region(surface);
+	surface->dirty |= DAMAGE_BACKGROUND;
+	render(surface);
+}
+
+static void load_image_thread(GTask *task, gpointer source_object,
+							  gpointer task_data, GCancellable *cancellable)
+{
+	struct swaylock_image *image = task_data;
+	g_task_return_pointer(task, load_background_image(image->path),
+						  (GDestroyNotify)cairo_surface_destroy);
+}
+
+static void load_image_done(GObject *source_object, GAsyncResult *res,
+							gpointer user_data)
+{
+	struct swaylock_state *state = user_data;
+	struct swaylock_image *image = g_task_get_task_data(G_TASK(res));
+	image->cairo_surface = g_task_propagate_pointer(G_TASK(res), NULL);
+	image->decoding = false;
 	if (!image->cairo_surface)
 	{
+		// Outputs fall back to the default image, or the solid color
+		wl_list_remove(&image->link);
+		free(image->output_name);
+		free(image->path);
 		free(image);
+	}
+	else
+	{
+		swaylock_log(LOG_DEBUG, "Loaded image %s for output %s", image->path,
+					 image->output_name ? image->output_name : "*");
+	}
+
+	struct swaylock_surface *surface;
+	wl_list_for_each(surface, &state->surfaces, link)
+	{
+		update_surface_image(surface);
+	}
+}
+
+// Decodes the image on a worker thread so that locking does not wait for it.
+// Surfaces show the solid background color until their image is ready; the
+// result is delivered through the GLib main context. Nothing is started while
+// threads are deferred; load_images is called again once they are not.
+void decode_image(struct swaylock_state *state, struct swaylock_image *image)
+{
+	// Background scaling needs the decoded image as well, so deferring this
+	// keeps every worker thread from starting before daemonize()
+	if (image->cairo_surface || image->decoding || state->defer_threads)
+	{
 		return;
 	}
-	wl_list_insert(&state->images, &image->link);
-	swaylock_log(LOG_DEBUG, "Loaded image %s for output %s", image->path,
-				 image->output_name ? image->output_name : "*");
+	image->decoding = true;
+
+	GTask *task = g_task_new(NULL, NULL, load_image_done, state);
+	g_task_set_task_data(task, image, NULL);
+	g_task_run_in_thread(task, load_image_thread);
+	g_object_unref(task);
+}
+
+static void load_images(struct swaylock_state *state)
+{
+	if (state->args.image_cache)
+	{
+		// Decoded lazily by render, only when the on-disk cache misses
+		return;
+	}
+
+	struct swaylock_image *image;
+	wl_list_for_each(image, &state->images, link)
+	{
+		decode_image(state, image);
+	}
 }
 
 static void set_default_colors(struct swaylock_colors *colors)
@@ -551,6 +766,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		LO_CAPS_LOCK_KEY_HL_COLOR,
 		LO_FONT,
 		LO_FONT_SIZE,
+		LO_IMAGE_CACHE,
 		LO_IND_IDLE_VISIBLE,
 		LO_IND_RADIUS,
 		LO_IND_X_POSITION,
@@ -570,12 +786,15 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		LO_LINE_CAPS_LOCK_COLOR,
 		LO_LINE_VER_COLOR,
 		LO_LINE_WRONG_COLOR,
+		LO_PAM_PREWARM,
+		LO_PAM_WORKERS,
 		LO_RING_COLOR,
 		LO_RING_CLEAR_COLOR,
 		LO_RING_CAPS_LOCK_COLOR,
 		LO_RING_VER_COLOR,
 		LO_RING_WRONG_COLOR,
 		LO_SEP_COLOR,
+		LO_STATS,
 		LO_TEXT_COLOR,
 		LO_TEXT_CLEAR_COLOR,
 		LO_TEXT_CAPS_LOCK_COLOR,
@@ -609,6 +828,7 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		{"caps-lock-key-hl-color", required_argument, NULL, LO_CAPS_LOCK_KEY_HL_COLOR},
 		{"font", required_argument, NULL, LO_FONT},
 		{"font-size", required_argument, NULL, LO_FONT_SIZE},
+		{"image-cache", no_argument, NULL, LO_IMAGE_CACHE},
 		{"indicator-idle-visible", no_argument, NULL, LO_IND_IDLE_VISIBLE},
 		{"indicator-radius", required_argument, NULL, LO_IND_RADIUS},
 		{"indicator-thickness", required_argument, NULL, LO_IND_THICKNESS},
@@ -628,12 +848,15 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		{"line-caps-lock-color", required_argument, NULL, LO_LINE_CAPS_LOCK_COLOR},
 		{"line-ver-color", required_argument, NULL, LO_LINE_VER_COLOR},
 		{"line-wrong-color", required_argument, NULL, LO_LINE_WRONG_COLOR},
+		{"pam-prewarm", no_argument, NULL, LO_PAM_PREWARM},
+		{"pam-workers", required_argument, NULL, LO_PAM_WORKERS},
 		{"ring-color", required_argument, NULL, LO_RING_COLOR},
 		{"ring-clear-color", required_argument, NULL, LO_RING_CLEAR_COLOR},
 		{"ring-caps-lock-color", required_argument, NULL, LO_RING_CAPS_LOCK_COLOR},
 		{"ring-ver-color", required_argument, NULL, LO_RING_VER_COLOR},
 		{"ring-wrong-color", required_argument, NULL, LO_RING_WRONG_COLOR},
 		{"separator-color", required_argument, NULL, LO_SEP_COLOR},
+		{"stats", no_argument, NULL, LO_STATS},
 		{"text-color", required_argument, NULL, LO_TEXT_COLOR},
 		{"text-clear-color", required_argument, NULL, LO_TEXT_CLEAR_COLOR},
 		{"text-caps-lock-color", required_argument, NULL, LO_TEXT_CAPS_LOCK_COLOR},
@@ -692,6 +915,8 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		"Sets the font of the text.\n"
 		"  --font-size <size>               "
 		"Sets a fixed font size for the indicator text.\n"
+		"  --image-cache                    "
+		"Cache scaled images in $XDG_CACHE_HOME/swaylock.\n"
 		"  --indicator-idle-visible         "
 		"Sets the indicator to show even if idle.\n"
 		"  --indicator-radius <radius>      "
@@ -739,6 +964,10 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		"Use the inside color for the line between the inside and ring.\n"
 		"  -r, --line-uses-ring             "
 		"Use the ring color for the line between the inside and ring.\n"
+		"  --pam-prewarm                    "
+		"Run the PAM account phase once when locking.\n"
+		"  --pam-workers <n>                "
+		"Check up to n passwords with PAM at the same time.\n"
 		"  --ring-color <color>             "
 		"Sets the color of the ring of the indicator.\n"
 		"  --ring-clear-color <color>       "
@@ -752,6 +981,8 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 		"Sets the color of the ring of the indicator when invalid.\n"
 		"  --separator-color <color>        "
 		"Sets the color of the lines that separate highlight segments.\n"
+		"  --stats                          "
+		"Print latency percentiles on SIGUSR2 and at exit.\n"
 		"  --text-color <color>             "
 		"Sets the color of the text.\n"
 		"  --text-clear-color <color>       "
@@ -922,6 +1153,12 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 				state->args.font_size = atoi(optarg);
 			}
 			break;
+		case LO_IMAGE_CACHE:
+			if (state)
+			{
+				state->args.image_cache = true;
+			}
+			break;
 		case LO_IND_IDLE_VISIBLE:
 			if (state)
 			{
@@ -1038,6 +1275,27 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 				state->args.colors.line.wrong = parse_color(optarg);
 			}
 			break;
+		case LO_PAM_PREWARM:
+			if (state)
+			{
+				state->args.pam_prewarm = true;
+			}
+			break;
+		case LO_PAM_WORKERS:
+			if (state)
+			{
+				char *end;
+				long workers = strtol(optarg, &end, 10);
+				if (*end != '\0' || workers < 1 || workers > MAX_PAM_WORKERS)
+				{
+					swaylock_log(LOG_ERROR, "--pam-workers must be between 1 "
+											"and %d, using 1",
+								 MAX_PAM_WORKERS);
+					workers = 1;
+				}
+				state->args.pam_workers = workers;
+			}
+			break;
 		case LO_RING_COLOR:
 			if (state)
 			{
@@ -1074,6 +1332,12 @@ static int parse_options(int argc, char **argv, struct swaylock_state *state,
 				state->args.colors.separator = parse_color(optarg);
 			}
 			break;
+		case LO_STATS:
+			if (state)
+			{
+				state->args.stats = true;
+			}
+			break;
 		case LO_TEXT_COLOR:
 			if (state)
 			{
@@ -1214,30 +1478,80 @@ static void display_in(int fd, short mask, void *data)
 
 static void comm_in(int fd, short mask, void *data)
 {
-	if (read_comm_reply())
+	struct comm_reply reply;
+	if (!read_comm_reply(&reply))
 	{
-		// Authentication succeeded
-		state.run_display = false;
+		if (mask & (POLLHUP | POLLERR))
+		{
+			swaylock_log(LOG_ERROR, "Password checking subprocess crashed; exiting.");
+			exit(EXIT_FAILURE);
+		}
+		reply.id = state.auth_request_id;
+		reply.status = COMM_STATUS_FAILURE;
+		reply.message[0] = '\0';
 	}
-	else if (mask & (POLLHUP | POLLERR))
+
+	if (reply.id == state.auth_request_id)
 	{
-		swaylock_log(LOG_ERROR, "Password checking subprocess crashed; exiting.");
-		exit(EXIT_FAILURE);
+		stats_record(STATS_AUTH, state.auth_request_time);
 	}
-	else
+
+	if (reply.status == COMM_STATUS_SUCCESS)
+	{
+		// Authentication succeeded, even if a later attempt was made since
+		auth_broker_succeeded(&state, AUTH_SOURCE_PASSWORD);
+		return;
+	}
+	if (reply.id != state.auth_request_id || reply.status == COMM_STATUS_CANCELLED)
 	{
-		state.auth_state = AUTH_STATE_INVALID;
-		schedule_auth_idle(&state);
-		++state.failed_attempts;
+		swaylock_log(LOG_DEBUG, "Dropping reply to superseded pw check %u", reply.id);
+		return;
+	}
+
+	state.auth_request_id = 0;
+	++state.failed_attempts;
+	if (!auth_broker_failed(&state, AUTH_SOURCE_PASSWORD))
+	{
+		// Another factor has shown its status since, keep it
 		damage_state(&state);
+		return;
+	}
+	state.auth_state = AUTH_STATE_INVALID;
+	if (reply.status == COMM_STATUS_ERROR)
+	{
+		snprintf(state.auth_error, sizeof(state.auth_error), "%s", reply.message);
+	}
+	else
+	{
+		state.auth_error[0] = '\0';
+	}
+	if (reply.retry_after_ms > 0)
+	{
+		swaylock_log(LOG_DEBUG, "Next pw check possible in %d ms", reply.retry_after_ms);
+	}
+	schedule_auth_idle(&state);
+	damage_state(&state);
+}
+
+static void cancel_password_check(void *data)
+{
+	if (state.auth_request_id)
+	{
+		write_comm_cancel(state.auth_request_id);
+		state.auth_request_id = 0;
 	}
 }
 
-static void term_in(int fd, short mask, void *data)
+static void term_in(void *data)
 {
 	state.run_display = false;
 }
 
+static void stats_in(void *data)
+{
+	stats_dump();
+}
+
 // Check for --debug 'early' we also apply the correct loglevel
 // to the forked child, without having to first proces all of the
 // configuration (including from file) before forking and (in the
@@ -1267,21 +1581,6 @@ void log_init(int argc, char **argv)
 	swaylock_log_init(LOG_ERROR);
 }
 
-static void check_fingerprint(void *d)
-{
-	struct FingerprintState *fingerprint_state = d;
-	if (fingerprint_verify(fingerprint_state))
-	{
-		do_sigusr(1);
-	}
-	else
-	{
-		(void)write(sigusr_fds[1], NULL, 0);
-	}
-
-	loop_add_timer(state.eventloop, 300, check_fingerprint, fingerprint_state);
-}
-
 int main(int argc, char **argv)
 {
 	log_init(argc, argv);
@@ -1310,6 +1609,7 @@ int main(int argc, char **argv)
 		.indicator_idle_visible = false,
 		.fingerprint = false,
 		.ready_fd = -1,
+		.pam_workers = 1,
 	};
 	wl_list_init(&state.images);
 	set_default_colors(&state.args.colors);
@@ -1358,6 +1658,16 @@ int main(int argc, char **argv)
 		state.args.colors.line = state.args.colors.ring;
 	}
 
+	start_pw_backend(&state.args);
+	stats_init(state.args.stats);
+	state.defer_threads = state.args.daemonize;
+
+	if (state.args.image_cache && !init_background_cache())
+	{
+		state.args.image_cache = false;
+	}
+	load_images(&state);
+
 	state.password.len = 0;
 	state.password.buffer_len = 1024;
 	state.password.buffer = password_buffer_create(state.password.buffer_len);
@@ -1366,18 +1676,9 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	if (pipe(sigusr_fds) != 0)
-	{
-		swaylock_log(LOG_ERROR, "Failed to pipe");
-		return EXIT_FAILURE;
-	}
-	if (fcntl(sigusr_fds[1], F_SETFL, O_NONBLOCK) == -1)
-	{
-		swaylock_log(LOG_ERROR, "Failed to make pipe end nonblocking");
-		return EXIT_FAILURE;
-	}
 
 	wl_list_init(&state.surfaces);
+	wl_list_init(&state.seats);
 	state.xkb.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	state.display = wl_display_connect(NULL);
 	if (!state.display)
@@ -1389,6 +1690,25 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 	state.eventloop = loop_create();
+	if (!loop_add_glib_main_context(state.eventloop))
+	{
+		return EXIT_FAILURE;
+	}
+
+	// Start connecting to the system bus now so it overlaps with the lock
+	// handshake; the replies are dispatched once the main loop runs. GDBus
+	// runs its own thread, which would not survive daemonize(), so that case
+	// connects after the fork instead.
+	struct FingerprintState fingerprint_state;
+	if (state.args.fingerprint && !state.args.daemonize)
+	{
+		fingerprint_init(&fingerprint_state, &state);
+		state.fingerprint_state = &fingerprint_state;
+	}
+	else
+	{
+		state.fingerprint_state = NULL;
+	}
 
 	struct wl_registry *registry = wl_display_get_registry(state.display);
 	wl_registry_add_listener(registry, &registry_listener, &state);
@@ -1431,9 +1751,14 @@ int main(int argc, char **argv)
 		free(state.args.font);
 		return 1;
 	}
-
-	state.test_surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 1, 1);
-	state.test_cairo = cairo_create(state.test_surface);
+#if HAVE_GL
+	// Once the dmabuf formats are in. EGL drivers may start threads, which
+	// would not survive daemonize(), so that case waits for the fork.
+	if (!state.defer_threads)
+	{
+		init_gl(&state);
+	}
+#endif
 
 	struct swaylock_surface *surface;
 	wl_list_for_each(surface, &state.surfaces, link)
@@ -1463,14 +1788,38 @@ int main(int argc, char **argv)
 	if (state.args.daemonize)
 	{
 		daemonize();
+		state.defer_threads = false;
+		load_images(&state);
+		if (state.args.image_cache)
+		{
+			// Images decoded lazily by render were skipped until now
+			damage_surfaces(&state, DAMAGE_BACKGROUND);
+		}
+		if (state.args.fingerprint)
+		{
+			fingerprint_init(&fingerprint_state, &state);
+			state.fingerprint_state = &fingerprint_state;
+		}
+#if HAVE_GL
+		init_gl(&state);
+		if (state.gl)
+		{
+			damage_surfaces(&state, DAMAGE_BACKGROUND);
+		}
+#endif
 	}
 
 	loop_add_fd(state.eventloop, wl_display_get_fd(state.display), POLLIN,
 				display_in, NULL);
 
 	loop_add_fd(state.eventloop, get_comm_reply_fd(), POLLIN, comm_in, NULL);
+	auth_broker_add_source(&state, AUTH_SOURCE_PASSWORD, cancel_password_check, NULL);
 
-	loop_add_fd(state.eventloop, sigusr_fds[0], POLLIN, term_in, NULL);
+	sigusr_wakeup = loop_add_wakeup(state.eventloop, term_in, NULL);
+	if (!sigusr_wakeup)
+	{
+		return EXIT_FAILURE;
+	}
 
 	struct sigaction sa;
 	sa.sa_handler = do_sigusr;
@@ -1478,16 +1827,14 @@ int main(int argc, char **argv)
 	sa.sa_flags = SA_RESTART;
 	sigaction(SIGUSR1, &sa, NULL);
 
-	struct FingerprintState fingerprint_state;
-	if (state.args.fingerprint)
+	if (state.args.stats)
 	{
-		fingerprint_init(&fingerprint_state, &state);
-		loop_add_timer(state.eventloop, 100, check_fingerprint, &fingerprint_state);
-		state.fingerprint_state = &fingerprint_state;
-	}
-	else
-	{
-		state.fingerprint_state = NULL;
+		stats_wakeup = loop_add_wakeup(state.eventloop, stats_in, NULL);
+		if (stats_wakeup)
+		{
+			sa.sa_handler = do_sigusr2;
+			sigaction(SIGUSR2, &sa, NULL);
+		}
 	}
 
 	state.run_display = true;
@@ -1508,8 +1855,7 @@ int main(int argc, char **argv)
 	{
 		fingerprint_deinit(&fingerprint_state);
 	}
+	stats_dump();
 	free(state.args.font);
-	cairo_destroy(state.test_cairo);
-	cairo_surface_destroy(state.test_surface);
 	return 0;
 }
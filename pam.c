@@ -1,9 +1,13 @@
 #define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <poll.h>
 #include <pwd.h>
 #include <security/pam_appl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include <unistd.h>
 #include "comm.h"
 #include "log.h"
@@ -12,6 +16,30 @@
 
 static char *pw_buf = NULL;
 
+static struct {
+	bool prewarm;
+	int workers;
+} pam_options = { .workers = 1 };
+
+// A child process with its own PAM handle, fed by the backend child. The
+// password of its current request is in its slot.
+struct pam_worker {
+	int request_fd;
+	int reply_fd;
+	struct comm_password_slot *slot;
+	bool busy;
+};
+
+struct pam_worker_request {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct pam_worker_reply {
+	uint32_t id;
+	int32_t pam_status;
+};
+
 void initialize_pw_backend(int argc, char **argv) {
 	if (getuid() != geteuid() || getgid() != getegid()) {
 		swaylock_log(LOG_ERROR,
@@ -19,7 +47,12 @@ void initialize_pw_backend(int argc, char **argv) {
 			" backend. Run 'chmod a-s %s' to fix. Aborting.", argv[0]);
 		exit(EXIT_FAILURE);
 	}
-	if (!spawn_comm_child()) {
+}
+
+void start_pw_backend(const struct swaylock_args *args) {
+	pam_options.prewarm = args->pam_prewarm;
+	pam_options.workers = args->pam_workers;
+	if (!spawn_comm_child(run_pw_backend_child)) {
 		exit(EXIT_FAILURE);
 	}
 }
@@ -38,6 +71,10 @@ static int handle_conversation(int num_msg, const struct pam_message **msg,
 		switch (msg[i]->msg_style) {
 		case PAM_PROMPT_ECHO_OFF:
 		case PAM_PROMPT_ECHO_ON:
+			if (pw_buf == NULL) {
+				// Nothing to answer with while pre-warming
+				return PAM_CONV_ERR;
+			}
 			pam_reply[i].resp = strdup(pw_buf); // PAM clears and frees this
 			if (pam_reply[i].resp == NULL) {
 				swaylock_log(LOG_ERROR, "Allocation failed");
@@ -70,11 +107,11 @@ static const char *get_pam_auth_error(int pam_status) {
 	}
 }
 
-void run_pw_backend_child(void) {
+static pam_handle_t *start_pam(void) {
 	struct passwd *passwd = getpwuid(getuid());
 	char *username = passwd->pw_name;
 
-	const struct pam_conv conv = {
+	static const struct pam_conv conv = {
 		.conv = handle_conversation,
 		.appdata_ptr = NULL,
 	};
@@ -87,42 +124,243 @@ void run_pw_backend_child(void) {
 	/* This code does not run as root */
 	swaylock_log(LOG_DEBUG, "Prepared to authorize user %s", username);
 
+	if (pam_options.prewarm) {
+		/* Run the account phase once so that modules backed by a network
+		 * service open their connections before the first password. The
+		 * result does not matter, authentication runs it properly. */
+		int pam_status = pam_acct_mgmt(auth_handle, PAM_SILENT);
+		swaylock_log(LOG_DEBUG, "Pre-warmed PAM: %s",
+			pam_strerror(auth_handle, pam_status));
+	}
+	return auth_handle;
+}
+
+static int check_password(pam_handle_t *auth_handle, char *buf, size_t size) {
+	pw_buf = buf;
+	int pam_status = pam_authenticate(auth_handle, 0);
+	password_buffer_destroy(pw_buf, size);
+	pw_buf = NULL;
+
+	if (pam_status != PAM_SUCCESS) {
+		swaylock_log(LOG_ERROR, "pam_authenticate failed: %s",
+			get_pam_auth_error(pam_status));
+	}
+	return pam_status;
+}
+
+static bool write_pam_reply(uint32_t id, int pam_status) {
+	if (pam_status == PAM_SUCCESS) {
+		return write_comm_reply(id, COMM_STATUS_SUCCESS, 0, NULL);
+	}
+	return write_comm_reply(id, pam_status == PAM_AUTH_ERR ?
+		COMM_STATUS_FAILURE : COMM_STATUS_ERROR, 0,
+		get_pam_auth_error(pam_status));
+}
+
+static void end_pam(pam_handle_t *auth_handle, int pam_status) {
+	pam_setcred(auth_handle, PAM_REFRESH_CRED);
+
+	if (pam_end(auth_handle, pam_status) != PAM_SUCCESS) {
+		swaylock_log(LOG_ERROR, "pam_end failed");
+		exit(EXIT_FAILURE);
+	}
+
+	exit((pam_status == PAM_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static void run_pam_worker(int request_fd, int reply_fd,
+		struct comm_password_slot *slot) {
+	pam_handle_t *auth_handle = start_pam();
+
 	int pam_status = PAM_SUCCESS;
 	while (1) {
-		ssize_t size = read_comm_request(&pw_buf);
-		if (size < 0) {
+		struct pam_worker_request request;
+		int ret = comm_read_full(request_fd, &request, sizeof(request));
+		if (ret < 0) {
 			exit(EXIT_FAILURE);
-		} else if (size == 0) {
+		} else if (ret == 0) {
+			break;
+		}
+		char *buf = password_buffer_create(request.len);
+		if (!buf) {
+			exit(EXIT_FAILURE);
+		}
+		if (!comm_password_slot_read(slot, request.id, buf, request.len)) {
+			swaylock_log(LOG_ERROR, "PAM worker got no password");
+			exit(EXIT_FAILURE);
+		}
+
+		struct pam_worker_reply reply = {
+			.id = request.id,
+			.pam_status = check_password(auth_handle, buf, request.len),
+		};
+		if (!comm_write_full(reply_fd, &reply, sizeof(reply))) {
+			exit(EXIT_FAILURE);
+		}
+		pam_status = reply.pam_status;
+		if (pam_status == PAM_SUCCESS) {
 			break;
 		}
+	}
 
-		int pam_status = pam_authenticate(auth_handle, 0);
-		password_buffer_destroy(pw_buf, size);
-		pw_buf = NULL;
+	end_pam(auth_handle, pam_status);
+}
 
-		bool success = pam_status == PAM_SUCCESS;
-		if (!success) {
-			swaylock_log(LOG_ERROR, "pam_authenticate failed: %s",
-				get_pam_auth_error(pam_status));
+static bool spawn_pam_worker(struct pam_worker *workers, int index) {
+	struct comm_password_slot *slot = comm_password_slot_create();
+	if (!slot) {
+		return false;
+	}
+	int request[2], reply[2];
+	if (pipe(request) != 0) {
+		swaylock_log_errno(LOG_ERROR, "failed to create pipe");
+		return false;
+	}
+	if (pipe(reply) != 0) {
+		swaylock_log_errno(LOG_ERROR, "failed to create pipe");
+		return false;
+	}
+	pid_t child = fork();
+	if (child < 0) {
+		swaylock_log_errno(LOG_ERROR, "failed to fork");
+		return false;
+	} else if (child == 0) {
+		for (int i = 0; i < index; ++i) {
+			close(workers[i].request_fd);
+			close(workers[i].reply_fd);
 		}
+		close(request[1]);
+		close(reply[0]);
+		close(get_comm_request_fd());
+		password_buffer_pool_forked(true);
+		run_pam_worker(request[0], reply[1], slot);
+	}
+	close(request[0]);
+	close(reply[1]);
+	workers[index].request_fd = request[1];
+	workers[index].reply_fd = reply[0];
+	workers[index].slot = slot;
+	workers[index].busy = false;
+	return true;
+}
 
-		if (!write_comm_reply(success)) {
+/* Hands requests to the first idle worker, so a new attempt does not wait for
+ * an earlier one to sit out its PAM fail delay. */
+static void run_pam_pool(void) {
+	struct pam_worker workers[MAX_PAM_WORKERS];
+	int count = pam_options.workers;
+	for (int i = 0; i < count; ++i) {
+		if (!spawn_pam_worker(workers, i)) {
 			exit(EXIT_FAILURE);
 		}
+	}
 
-		if (success) {
-			/* Unsuccessful requests may be queued after a successful one;
-			 * do not process them. */
+	while (1) {
+		struct pollfd fds[MAX_PAM_WORKERS + 1];
+		struct pam_worker *idle = NULL;
+		for (int i = 0; i < count; ++i) {
+			fds[i] = (struct pollfd){workers[i].reply_fd, POLLIN, 0};
+			if (!workers[i].busy && !idle) {
+				idle = &workers[i];
+			}
+		}
+		// Leave requests queued while all workers are busy, so that the
+		// newest one supersedes the rest once a worker is free
+		fds[count] = (struct pollfd){get_comm_request_fd(),
+			idle ? POLLIN : 0, 0};
+
+		if (poll(fds, count + 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			swaylock_log_errno(LOG_ERROR, "poll failed");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < count; ++i) {
+			if (!fds[i].revents) {
+				continue;
+			}
+			struct pam_worker_reply reply;
+			if (comm_read_full(workers[i].reply_fd, &reply,
+					sizeof(reply)) != 1) {
+				swaylock_log(LOG_ERROR, "PAM worker exited");
+				exit(EXIT_FAILURE);
+			}
+			workers[i].busy = false;
+			comm_password_slot_clear(workers[i].slot, reply.id);
+			if (!write_pam_reply(reply.id, reply.pam_status)) {
+				exit(EXIT_FAILURE);
+			}
+			if (reply.pam_status == PAM_SUCCESS) {
+				/* Unsuccessful requests may be queued after a successful
+				 * one; do not process them. */
+				exit(EXIT_SUCCESS);
+			}
+		}
+
+		if (!idle) {
+			if (fds[count].revents & (POLLHUP | POLLERR)) {
+				// Nobody is left to read the replies
+				break;
+			}
+			continue;
+		} else if (!fds[count].revents) {
+			continue;
+		}
+		uint32_t id;
+		char *buf;
+		ssize_t size = try_read_comm_request(&id, &buf);
+		if (size == 0) {
 			break;
+		} else if (size < 0) {
+			if (errno == EAGAIN) {
+				continue;
+			}
+			exit(EXIT_FAILURE);
+		}
+		struct pam_worker_request request = { .id = id, .len = size };
+		bool written = comm_password_slot_write(idle->slot, id, buf, size) &&
+			comm_write_full(idle->request_fd, &request, sizeof(request));
+		password_buffer_destroy(buf, size);
+		if (!written) {
+			swaylock_log_errno(LOG_ERROR, "failed to pass pw to PAM worker");
+			exit(EXIT_FAILURE);
 		}
+		idle->busy = true;
 	}
 
-	pam_setcred(auth_handle, PAM_REFRESH_CRED);
+	exit(EXIT_SUCCESS);
+}
 
-	if (pam_end(auth_handle, pam_status) != PAM_SUCCESS) {
-		swaylock_log(LOG_ERROR, "pam_end failed");
-		exit(EXIT_FAILURE);
+void run_pw_backend_child(void) {
+	if (pam_options.workers > 1) {
+		run_pam_pool();
 	}
 
-	exit((pam_status == PAM_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE);
+	pam_handle_t *auth_handle = start_pam();
+
+	int pam_status = PAM_SUCCESS;
+	while (1) {
+		uint32_t id;
+		ssize_t size = read_comm_request(&id, &pw_buf);
+		if (size < 0) {
+			exit(EXIT_FAILURE);
+		} else if (size == 0) {
+			break;
+		}
+
+		int pam_status = check_password(auth_handle, pw_buf, size);
+		if (!write_pam_reply(id, pam_status)) {
+			exit(EXIT_FAILURE);
+		}
+
+		if (pam_status == PAM_SUCCESS) {
+			/* Unsuccessful requests may be queued after a successful one;
+			 * do not process them. */
+			break;
+		}
+	}
+
+	end_pam(auth_handle, pam_status);
 }
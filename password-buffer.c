@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS and madvise
 #include "password-buffer.h"
 #include "log.h"
 #include "swaylock.h"
@@ -11,6 +11,27 @@
 static bool mlock_supported = true;
 static long int page_size = 0;
 
+// Buffers handed out from the arena, smallest fitting class first
+struct password_size_class {
+	size_t size;
+	int count;
+	size_t offset; // in the arena
+	unsigned used; // bit per buffer
+};
+
+static struct password_size_class size_classes[] = {
+	{ .size = 256, .count = 8 },
+	{ .size = 1024, .count = 4 },
+	{ .size = 4096, .count = 2 },
+};
+
+#define SIZE_CLASS_COUNT (sizeof(size_classes) / sizeof(size_classes[0]))
+
+static char *arena = NULL;
+static size_t arena_size = 0;
+// Set once the arena could not be set up, so it is not tried again
+static bool arena_failed = false;
+
 static long int get_page_size() {
 	if (!page_size) {
 		page_size = sysconf(_SC_PAGESIZE);
@@ -55,7 +76,103 @@ static bool password_buffer_unlock(char *addr, size_t size) {
 	return true;
 }
 
+bool password_buffer_pool_init(void) {
+	if (arena) {
+		return true;
+	} else if (arena_failed) {
+		return false;
+	}
+
+	size_t size = 0;
+	for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+		size_classes[i].offset = size;
+		size += size_classes[i].size * size_classes[i].count;
+	}
+	size = (size + get_page_size() - 1) / get_page_size() * get_page_size();
+	char *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		swaylock_log_errno(LOG_ERROR, "failed to map password arena");
+		arena_failed = true;
+		return false;
+	}
+#ifdef MADV_DONTDUMP
+	madvise(addr, size, MADV_DONTDUMP);
+#endif
+	if (!password_buffer_lock(addr, size)) {
+		munmap(addr, size);
+		arena_failed = true;
+		return false;
+	}
+	arena = addr;
+	arena_size = size;
+	return true;
+}
+
+bool password_buffer_pool_forked(bool release_parent_buffers) {
+	if (!arena) {
+		return password_buffer_pool_init();
+	}
+	if (release_parent_buffers) {
+		clear_buffer(arena, arena_size);
+		for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+			size_classes[i].used = 0;
+		}
+	}
+	if (!password_buffer_lock(arena, arena_size)) {
+		if (release_parent_buffers) {
+			munmap(arena, arena_size);
+			arena = NULL;
+			arena_failed = true;
+		}
+		// Otherwise buffers in use are still cleared when destroyed
+		return false;
+	}
+	return true;
+}
+
+static char *password_arena_alloc(size_t size) {
+	for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+		struct password_size_class *class = &size_classes[i];
+		if (size > class->size) {
+			continue;
+		}
+		for (int j = 0; j < class->count; ++j) {
+			if (!(class->used & (1u << j))) {
+				class->used |= 1u << j;
+				return arena + class->offset + class->size * j;
+			}
+		}
+	}
+	return NULL;
+}
+
+static bool password_arena_free(char *buffer) {
+	if (!arena || buffer < arena || buffer >= arena + arena_size) {
+		return false;
+	}
+	size_t offset = buffer - arena;
+	for (size_t i = 0; i < SIZE_CLASS_COUNT; ++i) {
+		struct password_size_class *class = &size_classes[i];
+		size_t end = class->offset + class->size * class->count;
+		if (offset < end) {
+			int j = (offset - class->offset) / class->size;
+			clear_buffer(buffer, class->size);
+			class->used &= ~(1u << j);
+			return true;
+		}
+	}
+	return false;
+}
+
 char *password_buffer_create(size_t size) {
+	if (password_buffer_pool_init()) {
+		char *buffer = password_arena_alloc(size);
+		if (buffer) {
+			return buffer;
+		}
+	}
+
 	void *buffer;
 	int result = posix_memalign(&buffer, get_page_size(), size);
 	if (result) {
@@ -74,6 +191,9 @@ char *password_buffer_create(size_t size) {
 }
 
 void password_buffer_destroy(char *buffer, size_t size) {
+	if (password_arena_free(buffer)) {
+		return;
+	}
 	clear_buffer(buffer, size);
 	password_buffer_unlock(buffer, size);
 	free(buffer);
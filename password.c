@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE // for explicit_bzero
 #include <assert.h>
 #include <errno.h>
 #include <pwd.h>
@@ -5,16 +6,21 @@
 #include <string.h>
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
+#include "config.h"
 #include "comm.h"
 #include "log.h"
 #include "loop.h"
 #include "seat.h"
+#include "stats.h"
 #include "swaylock.h"
 #include "unicode.h"
 #include "fingerprint/fingerprint.h"
 
 void clear_buffer(char *buf, size_t size)
 {
+#if HAVE_EXPLICIT_BZERO
+	explicit_bzero(buf, size);
+#else
 	// Use volatile keyword so so compiler can't optimize this out.
 	volatile char *buffer = buf;
 	volatile char zero = '\0';
@@ -22,6 +28,7 @@ void clear_buffer(char *buf, size_t size)
 	{
 		buffer[i] = zero;
 	}
+#endif
 }
 
 void clear_password_buffer(struct swaylock_password *pw)
@@ -137,12 +144,21 @@ static void submit_password(struct swaylock_state *state)
 
 	state->input_state = INPUT_STATE_IDLE;
 	state->auth_state = AUTH_STATE_VALIDATING;
+	auth_broker_activity(state, AUTH_SOURCE_PASSWORD);
 	cancel_password_clear(state);
 	cancel_input_idle(state);
 
-	if (!write_comm_request(&state->password))
+	// The reply to an earlier attempt would only be dropped now
+	if (state->auth_request_id)
+	{
+		write_comm_cancel(state->auth_request_id);
+	}
+	state->auth_request_time = stats_now();
+	state->auth_request_id = write_comm_request(&state->password);
+	if (!state->auth_request_id)
 	{
 		state->auth_state = AUTH_STATE_INVALID;
+		state->auth_error[0] = '\0';
 		schedule_auth_idle(state);
 	}
 
@@ -1,4 +1,7 @@
 #define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _GNU_SOURCE // memfd_create
+#endif
 #include <assert.h>
 #include <cairo/cairo.h>
 #include <errno.h>
@@ -12,7 +15,27 @@
 #include <wayland-client.h>
 #include "pool-buffer.h"
 
+// Address space reserved for each shm_pool, so that it can grow without
+// moving the buffers already allocated in it
+#define SHM_POOL_RESERVE (256 * 1024 * 1024)
+#define SHM_POOL_MIN_SIZE (64 * 1024)
+#define SHM_POOL_ALIGN 64
+
+struct shm_range {
+	size_t offset, size;
+	struct shm_range *next;
+};
+
+static void shm_pool_free(struct shm_pool *pool, size_t offset, size_t size);
+
 static int anonymous_shm_open(void) {
+#ifdef MFD_CLOEXEC
+	int memfd = memfd_create("swaylock", MFD_CLOEXEC);
+	if (memfd >= 0) {
+		return memfd;
+	}
+#endif
+
 	int retries = 100;
 
 	do {
@@ -81,6 +104,171 @@ struct pool_buffer *create_buffer(struct wl_shm *shm,
 	return buf;
 }
 
+static bool shm_pool_grow(struct shm_pool *pool, struct wl_shm *shm,
+		size_t needed) {
+	size_t size = pool->size * 2;
+	if (size < pool->size + needed) {
+		size = pool->size + needed;
+	}
+	if (size < SHM_POOL_MIN_SIZE) {
+		size = SHM_POOL_MIN_SIZE;
+	}
+	if (size > SHM_POOL_RESERVE) {
+		return false;
+	}
+
+	if (!pool->pool) {
+		pool->data = mmap(NULL, SHM_POOL_RESERVE, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (pool->data == MAP_FAILED) {
+			pool->data = NULL;
+			return false;
+		}
+		pool->fd = anonymous_shm_open();
+		if (pool->fd == -1) {
+			munmap(pool->data, SHM_POOL_RESERVE);
+			pool->data = NULL;
+			return false;
+		}
+	}
+
+	if (ftruncate(pool->fd, size) < 0 ||
+			mmap(pool->data, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, pool->fd, 0) == MAP_FAILED) {
+		if (!pool->pool) {
+			close(pool->fd);
+			munmap(pool->data, SHM_POOL_RESERVE);
+			pool->data = NULL;
+		}
+		return false;
+	}
+	if (pool->pool) {
+		wl_shm_pool_resize(pool->pool, size);
+	} else {
+		pool->pool = wl_shm_create_pool(shm, pool->fd, size);
+	}
+
+	shm_pool_free(pool, pool->size, size - pool->size);
+	pool->size = size;
+	return true;
+}
+
+static bool shm_pool_alloc(struct shm_pool *pool, struct wl_shm *shm,
+		size_t size, size_t *offset) {
+	size = (size + SHM_POOL_ALIGN - 1) & ~(size_t)(SHM_POOL_ALIGN - 1);
+
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		struct shm_range **link = &pool->free;
+		for (struct shm_range *range = *link; range;
+				link = &range->next, range = *link) {
+			if (range->size < size) {
+				continue;
+			}
+			*offset = range->offset;
+			range->offset += size;
+			range->size -= size;
+			if (range->size == 0) {
+				*link = range->next;
+				free(range);
+			}
+			return true;
+		}
+
+		// The end of the pool may already be free, only grow by the rest
+		size_t tail = 0;
+		for (struct shm_range *range = pool->free; range; range = range->next) {
+			if (range->offset + range->size == pool->size) {
+				tail = range->size;
+			}
+		}
+		if (attempt > 0 || !shm_pool_grow(pool, shm, size - tail)) {
+			return false;
+		}
+	}
+	return false;
+}
+
+static void shm_pool_free(struct shm_pool *pool, size_t offset, size_t size) {
+	size = (size + SHM_POOL_ALIGN - 1) & ~(size_t)(SHM_POOL_ALIGN - 1);
+
+	// Ranges are kept sorted by offset and merged with their neighbors
+	struct shm_range *prev = NULL, *next = pool->free;
+	while (next && next->offset < offset) {
+		prev = next;
+		next = next->next;
+	}
+
+	if (prev && prev->offset + prev->size == offset) {
+		prev->size += size;
+		if (next && prev->offset + prev->size == next->offset) {
+			prev->size += next->size;
+			prev->next = next->next;
+			free(next);
+		}
+		return;
+	}
+	if (next && offset + size == next->offset) {
+		next->offset = offset;
+		next->size += size;
+		return;
+	}
+
+	struct shm_range *range = malloc(sizeof(struct shm_range));
+	if (!range) {
+		// The range leaks until the pool is destroyed
+		return;
+	}
+	range->offset = offset;
+	range->size = size;
+	range->next = next;
+	if (prev) {
+		prev->next = range;
+	} else {
+		pool->free = range;
+	}
+}
+
+void shm_pool_finish(struct shm_pool *pool) {
+	if (pool->pool) {
+		wl_shm_pool_destroy(pool->pool);
+		close(pool->fd);
+		munmap(pool->data, SHM_POOL_RESERVE);
+	}
+	while (pool->free) {
+		struct shm_range *next = pool->free->next;
+		free(pool->free);
+		pool->free = next;
+	}
+	memset(pool, 0, sizeof(struct shm_pool));
+}
+
+static struct pool_buffer *create_pool_buffer(struct wl_shm *shm,
+		struct shm_pool *pool, struct pool_buffer *buf,
+		int32_t width, int32_t height, uint32_t format) {
+	uint32_t stride = width * 4;
+	size_t size = stride * height;
+	size_t offset;
+	if (size == 0 || !shm_pool_alloc(pool, shm, size, &offset)) {
+		return NULL;
+	}
+
+	void *data = (char *)pool->data + offset;
+	buf->buffer = wl_shm_pool_create_buffer(pool->pool, offset,
+			width, height, stride, format);
+	wl_buffer_add_listener(buf->buffer, &buffer_listener, buf);
+
+	buf->pool = pool;
+	buf->offset = offset;
+	buf->size = size;
+	buf->width = width;
+	buf->height = height;
+	buf->data = data;
+	buf->surface = cairo_image_surface_create_for_data(data,
+			CAIRO_FORMAT_ARGB32, width, height, stride);
+	buf->cairo = cairo_create(buf->surface);
+	return buf;
+}
+
 void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->buffer) {
 		wl_buffer_destroy(buffer->buffer);
@@ -91,13 +279,15 @@ void destroy_buffer(struct pool_buffer *buffer) {
 	if (buffer->surface) {
 		cairo_surface_destroy(buffer->surface);
 	}
-	if (buffer->data) {
+	if (buffer->pool) {
+		shm_pool_free(buffer->pool, buffer->offset, buffer->size);
+	} else if (buffer->data) {
 		munmap(buffer->data, buffer->size);
 	}
 	memset(buffer, 0, sizeof(struct pool_buffer));
 }
 
-struct pool_buffer *get_next_buffer(struct wl_shm *shm,
+struct pool_buffer *get_next_buffer(struct wl_shm *shm, struct shm_pool *shm_pool,
 		struct pool_buffer pool[static 2], uint32_t width, uint32_t height) {
 	struct pool_buffer *buffer = NULL;
 
@@ -117,7 +307,10 @@ struct pool_buffer *get_next_buffer(struct wl_shm *shm,
 	}
 
 	if (!buffer->buffer) {
-		if (!create_buffer(shm, buffer, width, height,
+		// Fall back to a dedicated shm file if the pool cannot hold it
+		if (!(shm_pool && create_pool_buffer(shm, shm_pool, buffer,
+						width, height, WL_SHM_FORMAT_ARGB8888)) &&
+				!create_buffer(shm, buffer, width, height,
 					WL_SHM_FORMAT_ARGB8888)) {
 			return NULL;
 		}
@@ -0,0 +1,772 @@
+#define _POSIX_C_SOURCE 200809L
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gbm.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <xf86drm.h>
+#include "log.h"
+#include "render-gl.h"
+#include "linux-dmabuf-v1-client-protocol.h"
+
+// Images kept as textures; there is usually a single one for all outputs
+#define TEXTURE_CACHE_SIZE 4
+#define MAX_DRM_DEVICES 64
+#define MAX_PLANES 4
+
+// cairo's 32-bit pixels are uploaded byte by byte as RGBA
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TEXTURE_SWIZZLE "gbar"
+#else
+#define TEXTURE_SWIZZLE "bgra"
+#endif
+
+struct gl_texture {
+	cairo_surface_t *image; // referenced, NULL if the slot is free
+	GLuint texture;
+	bool opaque;
+	unsigned long last_used;
+};
+
+struct swaylock_gl {
+	struct zwp_linux_dmabuf_v1 *dmabuf;
+	// Advertised for DRM_FORMAT_ARGB8888, besides DRM_FORMAT_MOD_INVALID
+	uint64_t *modifiers;
+	size_t modifier_count;
+	bool implicit_modifier; // DRM_FORMAT_MOD_INVALID was advertised
+
+	int drm_fd;
+	struct gbm_device *gbm;
+	EGLDisplay display;
+	EGLContext context;
+	PFNEGLCREATEIMAGEKHRPROC create_image;
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
+	bool full_npot; // mipmaps and repeat work for any texture size
+	GLint max_texture_size;
+	GLuint program;
+	GLint tex_uniform, opaque_uniform;
+	bool ready;
+
+	struct gl_texture textures[TEXTURE_CACHE_SIZE];
+	unsigned long texture_clock;
+};
+
+struct gl_buffer {
+	struct swaylock_gl *gl;
+	struct gbm_bo *bo;
+	EGLImageKHR image;
+	GLuint texture, framebuffer;
+	struct wl_buffer *buffer;
+	int width, height;
+	bool busy;
+};
+
+static const char vertex_shader_source[] =
+	"attribute vec2 position;\n"
+	"attribute vec2 texcoord;\n"
+	"varying vec2 v_texcoord;\n"
+	"void main() {\n"
+	"	gl_Position = vec4(position, 0.0, 1.0);\n"
+	"	v_texcoord = texcoord;\n"
+	"}\n";
+
+// Tiled images reach texture coordinates in the hundreds
+static const char fragment_shader_source[] =
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"uniform sampler2D tex;\n"
+	"uniform float opaque;\n"
+	"varying vec2 v_texcoord;\n"
+	"void main() {\n"
+	"	vec4 color = texture2D(tex, v_texcoord)." TEXTURE_SWIZZLE ";\n"
+	"	gl_FragColor = vec4(color.rgb, max(color.a, opaque));\n"
+	"}\n";
+
+static void dmabuf_handle_format(void *data,
+		struct zwp_linux_dmabuf_v1 *dmabuf, uint32_t format) {
+	// Superseded by the modifier event
+}
+
+static void dmabuf_handle_modifier(void *data,
+		struct zwp_linux_dmabuf_v1 *dmabuf, uint32_t format,
+		uint32_t modifier_hi, uint32_t modifier_lo) {
+	struct swaylock_gl *gl = data;
+	if (format != DRM_FORMAT_ARGB8888) {
+		return;
+	}
+	uint64_t modifier = (uint64_t)modifier_hi << 32 | modifier_lo;
+	if (modifier == DRM_FORMAT_MOD_INVALID) {
+		gl->implicit_modifier = true;
+		return;
+	}
+	uint64_t *modifiers = realloc(gl->modifiers,
+		(gl->modifier_count + 1) * sizeof(*modifiers));
+	if (!modifiers) {
+		return;
+	}
+	modifiers[gl->modifier_count++] = modifier;
+	gl->modifiers = modifiers;
+}
+
+static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
+	.format = dmabuf_handle_format,
+	.modifier = dmabuf_handle_modifier,
+};
+
+struct swaylock_gl *gl_create(struct zwp_linux_dmabuf_v1 *dmabuf) {
+	struct swaylock_gl *gl = calloc(1, sizeof(*gl));
+	if (!gl) {
+		zwp_linux_dmabuf_v1_destroy(dmabuf);
+		return NULL;
+	}
+	gl->dmabuf = dmabuf;
+	gl->drm_fd = -1;
+	gl->display = EGL_NO_DISPLAY;
+	gl->context = EGL_NO_CONTEXT;
+	zwp_linux_dmabuf_v1_add_listener(dmabuf, &dmabuf_listener, gl);
+	return gl;
+}
+
+static bool has_extension(const char *extensions, const char *name) {
+	if (!extensions) {
+		return false;
+	}
+	size_t len = strlen(name);
+	for (const char *ext = strstr(extensions, name); ext;
+			ext = strstr(ext + len, name)) {
+		if ((ext == extensions || ext[-1] == ' ') &&
+				(ext[len] == ' ' || ext[len] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int open_render_node(void) {
+	drmDevicePtr devices[MAX_DRM_DEVICES];
+	int count = drmGetDevices2(0, devices, MAX_DRM_DEVICES);
+	if (count < 0) {
+		swaylock_log(LOG_DEBUG, "Failed to list DRM devices: %s",
+			strerror(-count));
+		return -1;
+	}
+	int fd = -1;
+	for (int i = 0; i < count && fd < 0; ++i) {
+		if (!(devices[i]->available_nodes & (1 << DRM_NODE_RENDER))) {
+			continue;
+		}
+		const char *path = devices[i]->nodes[DRM_NODE_RENDER];
+		fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			swaylock_log_errno(LOG_DEBUG, "Failed to open %s", path);
+		} else {
+			swaylock_log(LOG_DEBUG, "Drawing backgrounds on %s", path);
+		}
+	}
+	drmFreeDevices(devices, count);
+	return fd;
+}
+
+static GLuint compile_shader(GLenum type, const char *source) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint ok;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[512];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		swaylock_log(LOG_ERROR, "Failed to compile shader: %s", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static GLuint create_program(void) {
+	GLuint vertex = compile_shader(GL_VERTEX_SHADER, vertex_shader_source);
+	GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
+	GLuint program = 0;
+	if (vertex && fragment) {
+		program = glCreateProgram();
+		glAttachShader(program, vertex);
+		glAttachShader(program, fragment);
+		glBindAttribLocation(program, 0, "position");
+		glBindAttribLocation(program, 1, "texcoord");
+		glLinkProgram(program);
+		GLint ok;
+		glGetProgramiv(program, GL_LINK_STATUS, &ok);
+		if (!ok) {
+			char log[512];
+			glGetProgramInfoLog(program, sizeof(log), NULL, log);
+			swaylock_log(LOG_ERROR, "Failed to link shaders: %s", log);
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+	// Kept alive by the program
+	glDeleteShader(vertex);
+	glDeleteShader(fragment);
+	return program;
+}
+
+bool gl_init(struct swaylock_gl *gl) {
+	gl->drm_fd = open_render_node();
+	if (gl->drm_fd < 0) {
+		swaylock_log(LOG_DEBUG, "No DRM render node");
+		return false;
+	}
+	gl->gbm = gbm_create_device(gl->drm_fd);
+	if (!gl->gbm) {
+		swaylock_log(LOG_ERROR, "Failed to create GBM device");
+		return false;
+	}
+
+	const char *client_extensions = eglQueryString(EGL_NO_DISPLAY,
+		EGL_EXTENSIONS);
+	if (!has_extension(client_extensions, "EGL_EXT_platform_base") ||
+			(!has_extension(client_extensions, "EGL_KHR_platform_gbm") &&
+			 !has_extension(client_extensions, "EGL_MESA_platform_gbm"))) {
+		swaylock_log(LOG_DEBUG, "EGL does not support GBM");
+		return false;
+	}
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+			"eglGetPlatformDisplayEXT");
+	gl->display = get_platform_display(EGL_PLATFORM_GBM_KHR, gl->gbm, NULL);
+	EGLint major, minor;
+	if (gl->display == EGL_NO_DISPLAY ||
+			!eglInitialize(gl->display, &major, &minor)) {
+		swaylock_log(LOG_ERROR, "Failed to initialize EGL");
+		gl->display = EGL_NO_DISPLAY;
+		return false;
+	}
+
+	const char *extensions = eglQueryString(gl->display, EGL_EXTENSIONS);
+	if (!has_extension(extensions, "EGL_KHR_image_base") ||
+			!has_extension(extensions, "EGL_EXT_image_dma_buf_import") ||
+			!has_extension(extensions, "EGL_KHR_surfaceless_context")) {
+		swaylock_log(LOG_DEBUG, "EGL cannot import dmabufs");
+		return false;
+	}
+	// Explicit modifiers cannot be imported without it
+	if (!has_extension(extensions, "EGL_EXT_image_dma_buf_import_modifiers")) {
+		gl->modifier_count = 0;
+	}
+	if (gl->modifier_count == 0 && !gl->implicit_modifier) {
+		swaylock_log(LOG_DEBUG, "No usable ARGB8888 dmabuf format");
+		return false;
+	}
+
+	EGLConfig config = EGL_NO_CONFIG_KHR;
+	if (!has_extension(extensions, "EGL_KHR_no_config_context")) {
+		static const EGLint config_attribs[] = {
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+			EGL_NONE,
+		};
+		EGLint config_count;
+		if (!eglChooseConfig(gl->display, config_attribs, &config, 1,
+				&config_count) || config_count == 0) {
+			swaylock_log(LOG_ERROR, "No OpenGL ES 2 EGL config");
+			return false;
+		}
+	}
+	static const EGLint context_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE,
+	};
+	if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+			(gl->context = eglCreateContext(gl->display, config,
+				EGL_NO_CONTEXT, context_attribs)) == EGL_NO_CONTEXT ||
+			!eglMakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+				gl->context)) {
+		swaylock_log(LOG_ERROR, "Failed to create EGL context");
+		return false;
+	}
+
+	const char *gl_extensions = (const char *)glGetString(GL_EXTENSIONS);
+	if (!has_extension(gl_extensions, "GL_OES_EGL_image")) {
+		swaylock_log(LOG_DEBUG, "OpenGL ES cannot use EGL images");
+		return false;
+	}
+	const char *version = (const char *)glGetString(GL_VERSION);
+	gl->full_npot = has_extension(gl_extensions, "GL_OES_texture_npot") ||
+		(version && strncmp(version, "OpenGL ES ", 10) == 0 &&
+		 version[10] >= '3');
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gl->max_texture_size);
+
+	gl->create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress(
+		"eglCreateImageKHR");
+	gl->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress(
+		"eglDestroyImageKHR");
+	gl->image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+		eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	if (!gl->create_image || !gl->destroy_image || !gl->image_target_texture) {
+		swaylock_log(LOG_ERROR, "Missing EGL image functions");
+		return false;
+	}
+
+	gl->program = create_program();
+	if (!gl->program) {
+		return false;
+	}
+	gl->tex_uniform = glGetUniformLocation(gl->program, "tex");
+	gl->opaque_uniform = glGetUniformLocation(gl->program, "opaque");
+
+	swaylock_log(LOG_DEBUG, "Drawing backgrounds with %s on EGL %d.%d",
+		version, major, minor);
+	gl->ready = true;
+	return true;
+}
+
+static void free_texture(struct gl_texture *texture) {
+	glDeleteTextures(1, &texture->texture);
+	cairo_surface_destroy(texture->image);
+	memset(texture, 0, sizeof(*texture));
+}
+
+void gl_destroy(struct swaylock_gl *gl) {
+	if (!gl) {
+		return;
+	}
+	if (gl->context != EGL_NO_CONTEXT) {
+		for (size_t i = 0; i < TEXTURE_CACHE_SIZE; ++i) {
+			if (gl->textures[i].image) {
+				free_texture(&gl->textures[i]);
+			}
+		}
+		if (gl->program) {
+			glDeleteProgram(gl->program);
+		}
+		eglMakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+			EGL_NO_CONTEXT);
+		eglDestroyContext(gl->display, gl->context);
+	}
+	if (gl->display != EGL_NO_DISPLAY) {
+		eglTerminate(gl->display);
+	}
+	if (gl->gbm) {
+		gbm_device_destroy(gl->gbm);
+	}
+	if (gl->drm_fd >= 0) {
+		close(gl->drm_fd);
+	}
+	zwp_linux_dmabuf_v1_destroy(gl->dmabuf);
+	free(gl->modifiers);
+	free(gl);
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+	struct gl_buffer *buffer = data;
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = buffer_release
+};
+
+static const EGLint plane_attribs[MAX_PLANES][5] = {
+	{
+		EGL_DMA_BUF_PLANE0_FD_EXT,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT,
+		EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT,
+	},
+	{
+		EGL_DMA_BUF_PLANE1_FD_EXT,
+		EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE1_PITCH_EXT,
+		EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+	},
+	{
+		EGL_DMA_BUF_PLANE2_FD_EXT,
+		EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE2_PITCH_EXT,
+		EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT,
+	},
+	{
+		EGL_DMA_BUF_PLANE3_FD_EXT,
+		EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+		EGL_DMA_BUF_PLANE3_PITCH_EXT,
+		EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+		EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT,
+	},
+};
+
+// Allocates a buffer object the compositor can read, imports it as the
+// target of a framebuffer, and only then shares it with the compositor
+static struct gl_buffer *create_gl_buffer(struct swaylock_gl *gl,
+		int width, int height) {
+	struct gl_buffer *buffer = calloc(1, sizeof(*buffer));
+	if (!buffer) {
+		return NULL;
+	}
+	buffer->gl = gl;
+	buffer->image = EGL_NO_IMAGE_KHR;
+	buffer->width = width;
+	buffer->height = height;
+
+	// Implicit modifiers are never passed on, so that the driver picks the
+	// layout on both sides
+	uint64_t modifier = DRM_FORMAT_MOD_INVALID;
+	if (gl->modifier_count > 0) {
+		buffer->bo = gbm_bo_create_with_modifiers(gl->gbm, width, height,
+			GBM_FORMAT_ARGB8888, gl->modifiers, gl->modifier_count);
+		if (buffer->bo) {
+			modifier = gbm_bo_get_modifier(buffer->bo);
+		}
+	}
+	if (!buffer->bo && gl->implicit_modifier) {
+		buffer->bo = gbm_bo_create(gl->gbm, width, height,
+			GBM_FORMAT_ARGB8888, GBM_BO_USE_RENDERING);
+	}
+	if (!buffer->bo) {
+		swaylock_log(LOG_ERROR, "Failed to allocate %dx%d GBM buffer",
+			width, height);
+		goto error;
+	}
+
+	int plane_count = gbm_bo_get_plane_count(buffer->bo);
+	if (plane_count <= 0 || plane_count > MAX_PLANES) {
+		goto error;
+	}
+	int fds[MAX_PLANES];
+	uint32_t offsets[MAX_PLANES], strides[MAX_PLANES];
+	EGLint attribs[6 + MAX_PLANES * 10 + 1];
+	size_t n = 0;
+	attribs[n++] = EGL_WIDTH;
+	attribs[n++] = width;
+	attribs[n++] = EGL_HEIGHT;
+	attribs[n++] = height;
+	attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[n++] = DRM_FORMAT_ARGB8888;
+	int fd_count = 0;
+	for (int i = 0; i < plane_count; ++i) {
+		fds[i] = gbm_bo_get_fd_for_plane(buffer->bo, i);
+		if (fds[i] < 0) {
+			swaylock_log(LOG_ERROR, "Failed to export GBM buffer");
+			goto error_fds;
+		}
+		++fd_count;
+		offsets[i] = gbm_bo_get_offset(buffer->bo, i);
+		strides[i] = gbm_bo_get_stride_for_plane(buffer->bo, i);
+		attribs[n++] = plane_attribs[i][0];
+		attribs[n++] = fds[i];
+		attribs[n++] = plane_attribs[i][1];
+		attribs[n++] = offsets[i];
+		attribs[n++] = plane_attribs[i][2];
+		attribs[n++] = strides[i];
+		if (modifier != DRM_FORMAT_MOD_INVALID) {
+			attribs[n++] = plane_attribs[i][3];
+			attribs[n++] = modifier & 0xFFFFFFFF;
+			attribs[n++] = plane_attribs[i][4];
+			attribs[n++] = modifier >> 32;
+		}
+	}
+	attribs[n++] = EGL_NONE;
+
+	buffer->image = gl->create_image(gl->display, EGL_NO_CONTEXT,
+		EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	if (buffer->image == EGL_NO_IMAGE_KHR) {
+		swaylock_log(LOG_ERROR, "Failed to import GBM buffer into EGL");
+		goto error_fds;
+	}
+	glGenTextures(1, &buffer->texture);
+	glBindTexture(GL_TEXTURE_2D, buffer->texture);
+	gl->image_target_texture(GL_TEXTURE_2D, buffer->image);
+	glGenFramebuffers(1, &buffer->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, buffer->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+		GL_TEXTURE_2D, buffer->texture, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		swaylock_log(LOG_ERROR, "GBM buffer cannot be drawn into: 0x%x",
+			status);
+		goto error_fds;
+	}
+
+	struct zwp_linux_buffer_params_v1 *params =
+		zwp_linux_dmabuf_v1_create_params(gl->dmabuf);
+	for (int i = 0; i < plane_count; ++i) {
+		zwp_linux_buffer_params_v1_add(params, fds[i], i, offsets[i],
+			strides[i], modifier >> 32, modifier & 0xFFFFFFFF);
+	}
+	buffer->buffer = zwp_linux_buffer_params_v1_create_immed(params,
+		width, height, DRM_FORMAT_ARGB8888, 0);
+	zwp_linux_buffer_params_v1_destroy(params);
+	for (int i = 0; i < fd_count; ++i) {
+		close(fds[i]);
+	}
+	wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+	return buffer;
+
+error_fds:
+	for (int i = 0; i < fd_count; ++i) {
+		close(fds[i]);
+	}
+error:
+	gl_destroy_buffer(buffer);
+	return NULL;
+}
+
+void gl_destroy_buffer(struct gl_buffer *buffer) {
+	if (!buffer) {
+		return;
+	}
+	if (buffer->buffer) {
+		wl_buffer_destroy(buffer->buffer);
+	}
+	if (buffer->framebuffer) {
+		glDeleteFramebuffers(1, &buffer->framebuffer);
+	}
+	if (buffer->texture) {
+		glDeleteTextures(1, &buffer->texture);
+	}
+	if (buffer->image != EGL_NO_IMAGE_KHR) {
+		buffer->gl->destroy_image(buffer->gl->display, buffer->image);
+	}
+	if (buffer->bo) {
+		gbm_bo_destroy(buffer->bo);
+	}
+	free(buffer);
+}
+
+static bool is_power_of_two(int n) {
+	return (n & (n - 1)) == 0;
+}
+
+static struct gl_texture *get_texture(struct swaylock_gl *gl,
+		cairo_surface_t *image) {
+	struct gl_texture *slot = NULL;
+	for (size_t i = 0; i < TEXTURE_CACHE_SIZE; ++i) {
+		struct gl_texture *texture = &gl->textures[i];
+		if (texture->image == image) {
+			texture->last_used = ++gl->texture_clock;
+			return texture;
+		}
+		// Images nobody else holds anymore are not drawn again
+		if (texture->image &&
+				cairo_surface_get_reference_count(texture->image) == 1) {
+			free_texture(texture);
+		}
+		if (!slot || texture->last_used < slot->last_used) {
+			slot = texture;
+		}
+	}
+
+	cairo_format_t format = cairo_image_surface_get_format(image);
+	int width = cairo_image_surface_get_width(image);
+	int height = cairo_image_surface_get_height(image);
+	int stride = cairo_image_surface_get_stride(image);
+	if ((format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24) ||
+			width <= 0 || height <= 0 || width > gl->max_texture_size ||
+			height > gl->max_texture_size) {
+		return NULL;
+	}
+	if (slot->image) {
+		free_texture(slot);
+	}
+
+	cairo_surface_flush(image);
+	const unsigned char *data = cairo_image_surface_get_data(image);
+	bool mipmaps = gl->full_npot ||
+		(is_power_of_two(width) && is_power_of_two(height));
+	glGenTextures(1, &slot->texture);
+	glBindTexture(GL_TEXTURE_2D, slot->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+		mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+		mipmaps ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (stride == width * 4) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+			GL_UNSIGNED_BYTE, data);
+	} else {
+		// OpenGL ES 2 has no row length to skip the padding with
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+			GL_UNSIGNED_BYTE, NULL);
+		for (int y = 0; y < height; ++y) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, 1, GL_RGBA,
+				GL_UNSIGNED_BYTE, data + (size_t)y * stride);
+		}
+	}
+	if (mipmaps) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	slot->image = cairo_surface_reference(image);
+	slot->opaque = format == CAIRO_FORMAT_RGB24;
+	slot->last_used = ++gl->texture_clock;
+	return slot;
+}
+
+static struct gl_buffer *get_next_gl_buffer(struct swaylock_gl *gl,
+		struct gl_buffer *buffers[static 2], int width, int height) {
+	struct gl_buffer **buffer = NULL;
+	for (size_t i = 0; i < 2; ++i) {
+		if (buffers[i] && buffers[i]->busy) {
+			continue;
+		}
+		buffer = &buffers[i];
+	}
+	if (!buffer) {
+		return NULL;
+	}
+	if (*buffer && ((*buffer)->width != width || (*buffer)->height != height)) {
+		gl_destroy_buffer(*buffer);
+		*buffer = NULL;
+	}
+	if (!*buffer) {
+		*buffer = create_gl_buffer(gl, width, height);
+	}
+	return *buffer;
+}
+
+// Place the image the way render_background_image does, as a rectangle in
+// buffer pixels and the part of the texture mapped onto it
+static void get_image_rect(enum background_mode mode, int image_width,
+		int image_height, int width, int height, double rect[static 4],
+		double texcoords[static 4]) {
+	double w = image_width, h = image_height;
+	double scale = 1;
+	texcoords[0] = texcoords[1] = 0;
+	texcoords[2] = texcoords[3] = 1;
+	switch (mode) {
+	case BACKGROUND_MODE_STRETCH:
+	case BACKGROUND_MODE_TILE:
+		rect[0] = rect[1] = 0;
+		rect[2] = width;
+		rect[3] = height;
+		if (mode == BACKGROUND_MODE_TILE) {
+			texcoords[2] = width / w;
+			texcoords[3] = height / h;
+		}
+		return;
+	case BACKGROUND_MODE_FILL:
+		scale = fmax(width / w, height / h);
+		break;
+	case BACKGROUND_MODE_FIT:
+		scale = fmin(width / w, height / h);
+		break;
+	case BACKGROUND_MODE_CENTER:
+		// Aligned to pixels, so that the image is not resampled
+		rect[0] = (int)(width / 2.0 - w / 2);
+		rect[1] = (int)(height / 2.0 - h / 2);
+		rect[2] = rect[0] + w;
+		rect[3] = rect[1] + h;
+		return;
+	case BACKGROUND_MODE_SOLID_COLOR:
+	case BACKGROUND_MODE_INVALID:
+		break;
+	}
+	rect[0] = (width - w * scale) / 2;
+	rect[1] = (height - h * scale) / 2;
+	rect[2] = rect[0] + w * scale;
+	rect[3] = rect[1] + h * scale;
+}
+
+static void draw_image(struct swaylock_gl *gl, struct gl_texture *texture,
+		enum background_mode mode, int width, int height) {
+	double rect[4], texcoords[4];
+	get_image_rect(mode, cairo_image_surface_get_width(texture->image),
+		cairo_image_surface_get_height(texture->image), width, height,
+		rect, texcoords);
+
+	// Buffer row 0 is the top, as is texture row 0, so nothing is flipped
+	GLfloat x0 = 2 * rect[0] / width - 1, x1 = 2 * rect[2] / width - 1;
+	GLfloat y0 = 2 * rect[1] / height - 1, y1 = 2 * rect[3] / height - 1;
+	const GLfloat positions[] = {
+		x0, y0, x1, y0, x0, y1, x1, y1,
+	};
+	GLfloat u0 = texcoords[0], v0 = texcoords[1];
+	GLfloat u1 = texcoords[2], v1 = texcoords[3];
+	const GLfloat coords[] = {
+		u0, v0, u1, v0, u0, v1, u1, v1,
+	};
+
+	glUseProgram(gl->program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture->texture);
+	glUniform1i(gl->tex_uniform, 0);
+	glUniform1f(gl->opaque_uniform, texture->opaque ? 1.0f : 0.0f);
+	// cairo pixels are premultiplied
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, positions);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, coords);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+	glDisable(GL_BLEND);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glUseProgram(0);
+}
+
+struct wl_buffer *gl_render_background(struct swaylock_gl *gl,
+		struct gl_buffer *buffers[static 2], cairo_surface_t *image,
+		enum background_mode mode, uint32_t color, int width, int height) {
+	if (!gl->ready || width > gl->max_texture_size ||
+			height > gl->max_texture_size) {
+		return NULL;
+	}
+	struct gl_texture *texture = NULL;
+	if (image && mode != BACKGROUND_MODE_SOLID_COLOR) {
+		int image_width = cairo_image_surface_get_width(image);
+		int image_height = cairo_image_surface_get_height(image);
+		if (mode == BACKGROUND_MODE_TILE && !gl->full_npot &&
+				!(is_power_of_two(image_width) &&
+				  is_power_of_two(image_height))) {
+			// Cannot repeat here, cairo tiles it instead
+			return NULL;
+		}
+		texture = get_texture(gl, image);
+		if (!texture) {
+			return NULL;
+		}
+	}
+	struct gl_buffer *buffer = get_next_gl_buffer(gl, buffers, width, height);
+	if (!buffer) {
+		return NULL;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, buffer->framebuffer);
+	glViewport(0, 0, width, height);
+	float a = (color & 0xFF) / 255.0f;
+	glClearColor((color >> 24 & 0xFF) / 255.0f * a,
+		(color >> 16 & 0xFF) / 255.0f * a,
+		(color >> 8 & 0xFF) / 255.0f * a, a);
+	glClear(GL_COLOR_BUFFER_BIT);
+	if (texture) {
+		draw_image(gl, texture, mode, width, height);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// Not every driver synchronizes dmabufs implicitly, and backgrounds are
+	// drawn rarely enough to wait for
+	glFinish();
+
+	buffer->busy = true;
+	return buffer->buffer;
+}
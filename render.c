@@ -1,49 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wayland-client.h>
+#include "config.h"
 #include "cairo.h"
 #include "background-image.h"
 #include "swaylock.h"
 #include "log.h"
+#include "stats.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#if HAVE_GL
+#include "render-gl.h"
+#endif
 
 #define M_PI 3.14159265358979323846
 const float TYPE_INDICATOR_RANGE = M_PI / 3.0f;
 const float TYPE_INDICATOR_BORDER_THICKNESS = M_PI / 128.0f;
 
-static void set_color_for_state(cairo_t *cairo, struct swaylock_state *state,
+static uint32_t color_for_state(struct swaylock_state *state,
 								struct swaylock_colorset *colorset)
 {
 	if (state->input_state == INPUT_STATE_CLEAR)
 	{
-		cairo_set_source_u32(cairo, colorset->cleared);
+		return colorset->cleared;
 	}
 	else if (state->auth_state == AUTH_STATE_VALIDATING)
 	{
-		cairo_set_source_u32(cairo, colorset->verifying);
+		return colorset->verifying;
 	}
 	else if (state->auth_state == AUTH_STATE_INVALID)
 	{
-		cairo_set_source_u32(cairo, colorset->wrong);
+		return colorset->wrong;
 	}
 	else
 	{
 		if (state->xkb.caps_lock && state->args.show_caps_lock_indicator)
 		{
-			cairo_set_source_u32(cairo, colorset->caps_lock);
+			return colorset->caps_lock;
 		}
 		else if (state->xkb.caps_lock && !state->args.show_caps_lock_indicator &&
-				 state->args.show_caps_lock_text)
+				 state->args.show_caps_lock_text &&
+				 colorset == &state->args.colors.text)
 		{
-			uint32_t inputtextcolor = state->args.colors.text.input;
-			state->args.colors.text.input = state->args.colors.text.caps_lock;
-			cairo_set_source_u32(cairo, colorset->input);
-			state->args.colors.text.input = inputtextcolor;
+			return state->args.colors.text.caps_lock;
 		}
 		else
 		{
-			cairo_set_source_u32(cairo, colorset->input);
+			return colorset->input;
+		}
+	}
+}
+
+static void set_color_for_state(cairo_t *cairo, struct swaylock_state *state,
+								struct swaylock_colorset *colorset)
+{
+	cairo_set_source_u32(cairo, color_for_state(state, colorset));
+}
+
+// Number of pre-rendered rings kept, one per state color combination seen
+#define RING_LAYER_CACHE_SIZE 8
+
+// The static part of the indicator: inner fill, ring, and their borders
+struct ring_layer {
+	uint32_t inside, ring, line;
+	int arc_radius, arc_thickness, scale;
+	cairo_surface_t *surface;
+	unsigned long last_used;
+};
+
+static struct ring_layer ring_layers[RING_LAYER_CACHE_SIZE];
+static unsigned long ring_layer_clock = 0;
+
+static void draw_ring_borders(cairo_t *cairo, double xc, double yc,
+							  int arc_radius, int arc_thickness, double angle1, double angle2)
+{
+	cairo_arc(cairo, xc, yc, arc_radius - arc_thickness / 2, angle1, angle2);
+	cairo_stroke(cairo);
+	cairo_arc(cairo, xc, yc, arc_radius + arc_thickness / 2, angle1, angle2);
+	cairo_stroke(cairo);
+}
+
+// Returns the ring for the current state colors, centered in a square of
+// (arc_radius + arc_thickness) * 2 pixels. Owned by the cache.
+static cairo_surface_t *get_ring_layer(struct swaylock_state *state,
+									   int arc_radius, int arc_thickness, int scale)
+{
+	uint32_t inside = color_for_state(state, &state->args.colors.inside);
+	uint32_t ring = color_for_state(state, &state->args.colors.ring);
+	uint32_t line = color_for_state(state, &state->args.colors.line);
+
+	struct ring_layer *slot = &ring_layers[0];
+	for (size_t i = 0; i < RING_LAYER_CACHE_SIZE; ++i)
+	{
+		struct ring_layer *layer = &ring_layers[i];
+		if (layer->surface && layer->inside == inside && layer->ring == ring &&
+			layer->line == line && layer->arc_radius == arc_radius &&
+			layer->arc_thickness == arc_thickness && layer->scale == scale)
+		{
+			layer->last_used = ++ring_layer_clock;
+			return layer->surface;
+		}
+		if (layer->last_used < slot->last_used)
+		{
+			slot = layer;
 		}
 	}
+
+	int diameter = (arc_radius + arc_thickness) * 2;
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+														  diameter, diameter);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	{
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	cairo_t *cairo = cairo_create(surface);
+	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
+
+	// Fill inner circle
+	cairo_set_line_width(cairo, 0);
+	cairo_arc(cairo, diameter / 2, diameter / 2,
+			  arc_radius - arc_thickness / 2, 0, 2 * M_PI);
+	cairo_set_source_u32(cairo, inside);
+	cairo_fill_preserve(cairo);
+	cairo_stroke(cairo);
+
+	// Draw ring
+	cairo_set_line_width(cairo, arc_thickness);
+	cairo_arc(cairo, diameter / 2, diameter / 2, arc_radius, 0, 2 * M_PI);
+	cairo_set_source_u32(cairo, ring);
+	cairo_stroke(cairo);
+
+	// Draw inner + outer border of the circle
+	cairo_set_source_u32(cairo, line);
+	cairo_set_line_width(cairo, 2.0 * scale);
+	draw_ring_borders(cairo, diameter / 2, diameter / 2,
+					  arc_radius, arc_thickness, 0, 2 * M_PI);
+
+	cairo_destroy(cairo);
+	cairo_surface_flush(surface);
+
+	cairo_surface_destroy(slot->surface);
+	*slot = (struct ring_layer){
+		.inside = inside,
+		.ring = ring,
+		.line = line,
+		.arc_radius = arc_radius,
+		.arc_thickness = arc_thickness,
+		.scale = scale,
+		.surface = surface,
+		.last_used = ++ring_layer_clock,
+	};
+	return surface;
 }
 
 static void surface_frame_handle_done(void *data, struct wl_callback *callback,
@@ -53,6 +164,8 @@ static void surface_frame_handle_done(void *data, struct wl_callback *callback,
 
 	wl_callback_destroy(callback);
 	surface->frame = NULL;
+	stats_record(STATS_KEY_TO_FRAME, surface->frame_key_time);
+	surface->frame_key_time = 0;
 
 	render(surface);
 }
@@ -64,96 +177,663 @@ static const struct wl_callback_listener surface_frame_listener = {
 static bool render_frame(struct swaylock_surface *surface);
 static bool render_fingerprint_status(struct swaylock_surface *surface);
 
-void render(struct swaylock_surface *surface)
+static struct wl_buffer *create_solid_buffer(struct swaylock_surface *surface)
 {
 	struct swaylock_state *state = surface->state;
+	uint32_t color = state->args.colors.background;
 
-	int buffer_width = surface->width * surface->scale;
-	int buffer_height = surface->height * surface->scale;
-	if (buffer_width == 0 || buffer_height == 0)
+	if (state->single_pixel_buffer_manager)
 	{
-		return; // not yet configured
+		// The protocol takes premultiplied 32-bit channels
+		uint32_t a = color & 0xFF;
+		uint32_t r = ((color >> 24) & 0xFF) * a / 0xFF;
+		uint32_t g = ((color >> 16) & 0xFF) * a / 0xFF;
+		uint32_t b = ((color >> 8) & 0xFF) * a / 0xFF;
+		surface->solid_buffer.buffer =
+			wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+				state->single_pixel_buffer_manager,
+				r * 0x01010101, g * 0x01010101, b * 0x01010101, a * 0x01010101);
+		return surface->solid_buffer.buffer;
 	}
 
-	if (!surface->dirty || surface->frame)
+	if (!create_buffer(state->shm, &surface->solid_buffer, 1, 1,
+					   WL_SHM_FORMAT_ARGB8888))
 	{
-		// Nothing to do or frame already pending
-		return;
+		return NULL;
+	}
+	cairo_t *cairo = surface->solid_buffer.cairo;
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_u32(cairo, color);
+	cairo_paint(cairo);
+	cairo_surface_flush(surface->solid_buffer.surface);
+	return surface->solid_buffer.buffer;
+}
+
+// Fills the background with a single pixel scaled by wp_viewporter, so solid
+// color locks do not need a buffer the size of the output
+static bool render_solid_background(struct swaylock_surface *surface)
+{
+	struct swaylock_state *state = surface->state;
+	if (!state->viewporter)
+	{
+		return false;
+	}
+
+	// The color never changes, so the buffer is created only once
+	if (!surface->solid_buffer.buffer && !create_solid_buffer(surface))
+	{
+		return false;
+	}
+	if (!surface->viewport)
+	{
+		surface->viewport = wp_viewporter_get_viewport(state->viewporter,
+													   surface->surface);
+	}
+
+	release_background(surface);
+	wl_surface_set_buffer_scale(surface->surface, 1);
+	wl_surface_attach(surface->surface, surface->solid_buffer.buffer, 0, 0);
+	wp_viewport_set_source(surface->viewport, wl_fixed_from_int(-1),
+						   wl_fixed_from_int(-1), wl_fixed_from_int(-1), wl_fixed_from_int(-1));
+	wp_viewport_set_destination(surface->viewport, surface->width, surface->height);
+	wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+	return true;
+}
+
+// Stretched and filled images that are not larger than the output are
+// attached at their own size and scaled by the compositor through
+// wp_viewporter, which usually does it on the GPU, instead of being
+// rasterized at the output size
+static bool render_viewport_background(struct swaylock_surface *surface,
+									   int buffer_width, int buffer_height)
+{
+	struct swaylock_state *state = surface->state;
+	cairo_surface_t *image = surface->image;
+	if (!state->viewporter || !image ||
+		(state->args.mode != BACKGROUND_MODE_STRETCH &&
+		 state->args.mode != BACKGROUND_MODE_FILL))
+	{
+		return false;
+	}
+	int image_width = cairo_image_surface_get_width(image);
+	int image_height = cairo_image_surface_get_height(image);
+	if (image_width <= 0 || image_height <= 0 ||
+		(int64_t)image_width * image_height > (int64_t)buffer_width * buffer_height)
+	{
+		return false;
+	}
+
+	struct pool_buffer *buffer = get_next_buffer(state->shm, NULL,
+												 surface->background_buffers, image_width, image_height);
+	if (!buffer)
+	{
+		return false;
+	}
+
+	uint64_t draw_start = stats_now();
+	cairo_t *cairo = buffer->cairo;
+	cairo_save(cairo);
+	cairo_identity_matrix(cairo);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	if (cairo_surface_get_content(image) != CAIRO_CONTENT_COLOR)
+	{
+		// Opaque images cover the whole buffer, which is then a plain copy
+		cairo_set_source_u32(cairo, state->args.colors.background);
+		cairo_paint(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
 	}
+	cairo_set_source_surface(cairo, image, 0, 0);
+	cairo_paint(cairo);
+	cairo_restore(cairo);
+	cairo_surface_flush(buffer->surface);
+	stats_record(STATS_DRAW_BACKGROUND, draw_start);
+
+	// Fill crops the image to the output's aspect ratio. The crop is rounded
+	// down so that it never reaches outside of the buffer.
+	wl_fixed_t src_x = 0, src_y = 0;
+	wl_fixed_t src_width = wl_fixed_from_int(image_width);
+	wl_fixed_t src_height = wl_fixed_from_int(image_height);
+	if (state->args.mode == BACKGROUND_MODE_FILL)
+	{
+		double scale = fmax((double)buffer_width / image_width,
+							(double)buffer_height / image_height);
+		double visible_width = fmin(buffer_width / scale, image_width);
+		double visible_height = fmin(buffer_height / scale, image_height);
+		src_x = wl_fixed_from_double((image_width - visible_width) / 2);
+		src_y = wl_fixed_from_double((image_height - visible_height) / 2);
+		src_width = wl_fixed_from_double(visible_width);
+		src_height = wl_fixed_from_double(visible_height);
+		if (src_x + src_width > wl_fixed_from_int(image_width))
+		{
+			src_width = wl_fixed_from_int(image_width) - src_x;
+		}
+		if (src_y + src_height > wl_fixed_from_int(image_height))
+		{
+			src_height = wl_fixed_from_int(image_height) - src_y;
+		}
+	}
+
+	if (!surface->viewport)
+	{
+		surface->viewport = wp_viewporter_get_viewport(state->viewporter,
+													   surface->surface);
+	}
+	release_background(surface);
+	wl_surface_set_buffer_scale(surface->surface, 1);
+	wl_surface_attach(surface->surface, buffer->buffer, 0, 0);
+	wp_viewport_set_source(surface->viewport, src_x, src_y, src_width, src_height);
+	wp_viewport_set_destination(surface->viewport, surface->width, surface->height);
+	wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+	return true;
+}
 
-	bool need_destroy = false;
+// Background buffers drawn on the CPU, shared by every output showing the
+// same pixels. They are never drawn into again once attached: a change of
+// any of their inputs makes a new one, and the old one is destroyed once no
+// surface uses it and the compositor has released it.
+struct shared_background
+{
+	char *path; // of the scaled image shown, NULL for the plain color
+	enum background_mode mode;
+	uint32_t color;
+	int width, height;
 	struct pool_buffer buffer;
+	int users;
+	struct shared_background *next;
+};
 
-	if (buffer_width != surface->last_buffer_width ||
-		buffer_height != surface->last_buffer_height)
+static struct shared_background *shared_backgrounds = NULL;
+
+static void sweep_shared_backgrounds(void)
+{
+	struct shared_background **link = &shared_backgrounds;
+	while (*link)
+	{
+		struct shared_background *shared = *link;
+		if (shared->users > 0 || shared->buffer.busy)
+		{
+			link = &shared->next;
+			continue;
+		}
+		*link = shared->next;
+		destroy_buffer(&shared->buffer);
+		free(shared->path);
+		free(shared);
+	}
+}
+
+static struct shared_background *find_shared_background(struct swaylock_state *state,
+														const char *path, int width, int height)
+{
+	for (struct shared_background *shared = shared_backgrounds; shared;
+		 shared = shared->next)
+	{
+		if (shared->width == width && shared->height == height &&
+			shared->color == state->args.colors.background &&
+			(path ? shared->path && shared->mode == state->args.mode &&
+						strcmp(shared->path, path) == 0
+				  : !shared->path))
+		{
+			return shared;
+		}
+	}
+	return NULL;
+}
+
+static struct shared_background *create_shared_background(struct swaylock_state *state,
+														  const char *path, int width, int height)
+{
+	sweep_shared_backgrounds();
+	struct shared_background *shared = calloc(1, sizeof(*shared));
+	if (!shared)
+	{
+		return NULL;
+	}
+	shared->path = path ? strdup(path) : NULL;
+	if ((path && !shared->path) ||
+		!create_buffer(state->shm, &shared->buffer, width, height,
+					   WL_SHM_FORMAT_ARGB8888))
+	{
+		free(shared->path);
+		free(shared);
+		return NULL;
+	}
+	shared->mode = state->args.mode;
+	shared->color = state->args.colors.background;
+	shared->width = width;
+	shared->height = height;
+	shared->next = shared_backgrounds;
+	shared_backgrounds = shared;
+	return shared;
+}
+
+void release_background(struct swaylock_surface *surface)
+{
+	if (surface->shared_background)
+	{
+		--surface->shared_background->users;
+		surface->shared_background = NULL;
+	}
+}
+
+static void scaled_background_ready(void *data)
+{
+	struct swaylock_state *state = data;
+	damage_surfaces(state, DAMAGE_BACKGROUND);
+}
+
+// Maps a background drawn at buffer size back onto the surface
+static void set_background_scale(struct swaylock_surface *surface)
+{
+	struct swaylock_state *state = surface->state;
+	if (surface->preferred_scale)
+	{
+		// Sized for the fractional scale, the viewport maps it back
+		if (!surface->viewport)
+		{
+			surface->viewport = wp_viewporter_get_viewport(state->viewporter,
+														   surface->surface);
+		}
+		wp_viewport_set_source(surface->viewport, wl_fixed_from_int(-1),
+							   wl_fixed_from_int(-1), wl_fixed_from_int(-1), wl_fixed_from_int(-1));
+		wp_viewport_set_destination(surface->viewport, surface->width, surface->height);
+		wl_surface_set_buffer_scale(surface->surface, 1);
+	}
+	else
+	{
+		if (surface->viewport)
+		{
+			// Left over from a solid color or compositor scaled frame
+			wp_viewport_set_source(surface->viewport, wl_fixed_from_int(-1),
+								   wl_fixed_from_int(-1), wl_fixed_from_int(-1), wl_fixed_from_int(-1));
+			wp_viewport_set_destination(surface->viewport, -1, -1);
+		}
+		wl_surface_set_buffer_scale(surface->surface, surface->scale);
+	}
+}
+
+#if HAVE_GL
+// Decoded images are scaled on the GPU at every size, instead of being
+// scaled once per size on the CPU and copied into a shm buffer
+static bool render_gl_background(struct swaylock_surface *surface,
+								 int buffer_width, int buffer_height)
+{
+	struct swaylock_state *state = surface->state;
+	if (!state->gl || !surface->image)
+	{
+		return false;
+	}
+
+	uint64_t draw_start = stats_now();
+	struct wl_buffer *buffer = gl_render_background(state->gl,
+													surface->gl_buffers, surface->image, state->args.mode,
+													state->args.colors.background, buffer_width, buffer_height);
+	if (!buffer)
+	{
+		return false;
+	}
+	stats_record(STATS_DRAW_BACKGROUND, draw_start);
+
+	release_background(surface);
+	set_background_scale(surface);
+	wl_surface_attach(surface->surface, buffer, 0, 0);
+	wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+	return true;
+}
+#endif
+
+static bool render_background(struct swaylock_surface *surface,
+							  int buffer_width, int buffer_height)
+{
+	struct swaylock_state *state = surface->state;
+	if (render_viewport_background(surface, buffer_width, buffer_height))
+	{
+		return true;
+	}
+#if HAVE_GL
+	if (render_gl_background(surface, buffer_width, buffer_height))
+	{
+		return true;
+	}
+#endif
+
+	cairo_surface_t *background = NULL;
+	struct shared_background *shared = NULL;
+	if (surface->image_source && state->args.mode != BACKGROUND_MODE_SOLID_COLOR)
+	{
+		// A shared buffer is the only copy kept of a scaled image
+		shared = find_shared_background(state, surface->image_source->path,
+										buffer_width, buffer_height);
+		if (!shared)
+		{
+			background = get_scaled_background(surface->image_source->path, surface->image,
+											   state->args.mode, state->args.colors.background,
+											   buffer_width, buffer_height, scaled_background_ready, state);
+		}
+		if (!shared && !background && !surface->image)
+		{
+			// Not cached, the image is repainted once it is decoded
+			decode_image(state, surface->image_source);
+		}
+		// Otherwise it is being scaled, and repainted once that is done
+	}
+
+	const char *path = background ? surface->image_source->path : NULL;
+	if (!shared)
+	{
+		shared = find_shared_background(state, path, buffer_width, buffer_height);
+	}
+	if (!shared)
 	{
-		need_destroy = true;
-		if (!create_buffer(state->shm, &buffer, buffer_width, buffer_height,
-						   WL_SHM_FORMAT_ARGB8888))
+		shared = create_shared_background(state, path, buffer_width, buffer_height);
+		if (!shared)
 		{
 			swaylock_log(LOG_ERROR,
 						 "Failed to create new buffer for frame background.");
-			return;
+			return false;
 		}
 
-		cairo_t *cairo = buffer.cairo;
+		uint64_t draw_start = stats_now();
+		cairo_t *cairo = shared->buffer.cairo;
 		cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
-
 		cairo_save(cairo);
 		cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-		cairo_set_source_u32(cairo, state->args.colors.background);
-		cairo_paint(cairo);
-		if (surface->image && state->args.mode != BACKGROUND_MODE_SOLID_COLOR)
+		if (background)
+		{
+			// Already at buffer size, this is a plain copy
+			cairo_set_source_surface(cairo, background, 0, 0);
+		}
+		else
 		{
-			cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
-			render_background_image(cairo, surface->image,
-									state->args.mode, buffer_width, buffer_height);
+			cairo_set_source_u32(cairo, state->args.colors.background);
 		}
+		cairo_paint(cairo);
 		cairo_restore(cairo);
-		cairo_identity_matrix(cairo);
+		cairo_surface_flush(shared->buffer.surface);
+		stats_record(STATS_DRAW_BACKGROUND, draw_start);
+		if (background)
+		{
+			release_scaled_background(background);
+		}
+	}
+	++shared->users;
+	release_background(surface);
+	surface->shared_background = shared;
+	shared->buffer.busy = true;
+
+	set_background_scale(surface);
+	wl_surface_attach(surface->surface, shared->buffer.buffer, 0, 0);
+	wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
+	return true;
+}
 
-		wl_surface_set_buffer_scale(surface->surface, surface->scale);
-		wl_surface_attach(surface->surface, buffer.buffer, 0, 0);
-		wl_surface_damage_buffer(surface->surface, 0, 0, INT32_MAX, INT32_MAX);
-		need_destroy = true;
+void render(struct swaylock_surface *surface)
+{
+	struct swaylock_state *state = surface->state;
+
+	// The background follows the fractional scale when the compositor
+	// prefers one, the subsurfaces keep the integer output scale
+	int buffer_width = surface->width * surface->scale;
+	int buffer_height = surface->height * surface->scale;
+	if (surface->preferred_scale)
+	{
+		buffer_width = (surface->width * surface->preferred_scale + 60) / 120;
+		buffer_height = (surface->height * surface->preferred_scale + 60) / 120;
+	}
+	if (buffer_width == 0 || buffer_height == 0)
+	{
+		return; // not yet configured
+	}
+
+	if (!surface->dirty || surface->frame)
+	{
+		// Nothing to do or frame already pending
+		return;
+	}
+	uint64_t render_start = stats_now();
+
+	if ((surface->dirty & DAMAGE_BACKGROUND) ||
+		buffer_width != surface->last_buffer_width ||
+		buffer_height != surface->last_buffer_height)
+	{
+		bool solid = !surface->image_source ||
+					 state->args.mode == BACKGROUND_MODE_SOLID_COLOR;
+		if (!(solid && render_solid_background(surface)) &&
+			!render_background(surface, buffer_width, buffer_height))
+		{
+			return;
+		}
 
 		surface->last_buffer_width = buffer_width;
 		surface->last_buffer_height = buffer_height;
 	}
 
-	render_frame(surface);
-	render_fingerprint_status(surface);
-	surface->dirty = false;
+	if (surface->dirty & DAMAGE_INDICATOR)
+	{
+		render_frame(surface);
+	}
+	if (surface->dirty & DAMAGE_FINGERPRINT_STATUS)
+	{
+		render_fingerprint_status(surface);
+	}
+	surface->dirty = 0;
 	surface->frame = wl_surface_frame(surface->surface);
 	wl_callback_add_listener(surface->frame, &surface_frame_listener, surface);
+	stats_record(STATS_RENDER, render_start);
 	wl_surface_commit(surface->surface);
+	surface->frame_key_time = stats_commit();
+}
 
-	if (need_destroy)
-	{
-		destroy_buffer(&buffer);
-	}
+// Fonts are kept per size and subpixel order, which only vary per output
+#define FONT_CACHE_SIZE 4
+// Strings kept per font; the indicator cycles through a handful of them
+#define TEXT_RUN_CACHE_SIZE 16
+
+// Extents and glyphs of a string, positioned relative to its origin
+struct text_run {
+	char *text;
+	cairo_text_extents_t extents;
+	cairo_glyph_t *glyphs;
+	int num_glyphs;
+	unsigned long last_used;
+};
+
+struct font {
+	const char *name;
+	double size;
+	enum wl_output_subpixel subpixel;
+	cairo_scaled_font_t *scaled_font;
+	cairo_font_extents_t extents;
+	struct text_run runs[TEXT_RUN_CACHE_SIZE];
+	unsigned long last_used;
+};
+
+static struct font fonts[FONT_CACHE_SIZE];
+static unsigned long font_clock = 0;
+
+static void free_text_run(struct text_run *run)
+{
+	free(run->text);
+	cairo_glyph_free(run->glyphs);
+	memset(run, 0, sizeof(struct text_run));
 }
 
-static void configure_font_drawing(cairo_t *cairo, struct swaylock_state *state,
-								   enum wl_output_subpixel subpixel, int arc_radius)
+static struct font *get_font(struct swaylock_state *state,
+							 enum wl_output_subpixel subpixel, int arc_radius)
 {
+	double size = state->args.font_size > 0 ? state->args.font_size : arc_radius / 3.0f;
+
+	struct font *slot = &fonts[0];
+	for (size_t i = 0; i < FONT_CACHE_SIZE; ++i)
+	{
+		struct font *font = &fonts[i];
+		if (font->scaled_font && font->name == state->args.font &&
+			font->size == size && font->subpixel == subpixel)
+		{
+			font->last_used = ++font_clock;
+			return font;
+		}
+		if (font->last_used < slot->last_used)
+		{
+			slot = font;
+		}
+	}
+
 	cairo_font_options_t *fo = cairo_font_options_create();
 	cairo_font_options_set_hint_style(fo, CAIRO_HINT_STYLE_FULL);
 	cairo_font_options_set_antialias(fo, CAIRO_ANTIALIAS_SUBPIXEL);
 	cairo_font_options_set_subpixel_order(fo, to_cairo_subpixel_order(subpixel));
 
-	cairo_set_font_options(cairo, fo);
-	cairo_select_font_face(cairo, state->args.font,
-						   CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	if (state->args.font_size > 0)
+	cairo_font_face_t *face = cairo_toy_font_face_create(state->args.font,
+														 CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_matrix_t font_matrix, ctm;
+	cairo_matrix_init_scale(&font_matrix, size, size);
+	cairo_matrix_init_identity(&ctm);
+	cairo_scaled_font_t *scaled_font = cairo_scaled_font_create(face, &font_matrix, &ctm, fo);
+	cairo_font_face_destroy(face);
+	cairo_font_options_destroy(fo);
+
+	for (size_t i = 0; i < TEXT_RUN_CACHE_SIZE; ++i)
 	{
-		cairo_set_font_size(cairo, state->args.font_size);
+		free_text_run(&slot->runs[i]);
 	}
-	else
+	if (slot->scaled_font)
 	{
-		cairo_set_font_size(cairo, arc_radius / 3.0f);
+		cairo_scaled_font_destroy(slot->scaled_font);
+	}
+	slot->name = state->args.font;
+	slot->size = size;
+	slot->subpixel = subpixel;
+	slot->scaled_font = scaled_font;
+	cairo_scaled_font_extents(scaled_font, &slot->extents);
+	slot->last_used = ++font_clock;
+	return slot;
+}
+
+static const struct text_run *get_text_run(struct font *font, const char *text)
+{
+	struct text_run *slot = &font->runs[0];
+	for (size_t i = 0; i < TEXT_RUN_CACHE_SIZE; ++i)
+	{
+		struct text_run *run = &font->runs[i];
+		if (run->text && strcmp(run->text, text) == 0)
+		{
+			run->last_used = ++font_clock;
+			return run;
+		}
+		if (run->last_used < slot->last_used)
+		{
+			slot = run;
+		}
+	}
+
+	free_text_run(slot);
+	slot->text = strdup(text);
+	cairo_scaled_font_text_extents(font->scaled_font, text, &slot->extents);
+	if (cairo_scaled_font_text_to_glyphs(font->scaled_font, 0, 0, text, -1,
+										 &slot->glyphs, &slot->num_glyphs, NULL, NULL, NULL) != CAIRO_STATUS_SUCCESS)
+	{
+		slot->glyphs = NULL;
+		slot->num_glyphs = 0;
+	}
+	// Without a copy of the text the run is still usable, just never found
+	slot->last_used = ++font_clock;
+	return slot;
+}
+
+// Draws the run with its origin at x, y using the current source
+static void show_text_run(cairo_t *cairo, struct font *font,
+						  const struct text_run *run, double x, double y)
+{
+	cairo_save(cairo);
+	cairo_set_scaled_font(cairo, font->scaled_font);
+	cairo_translate(cairo, x, y);
+	cairo_show_glyphs(cairo, run->glyphs, run->num_glyphs);
+	cairo_restore(cairo);
+}
+
+// Logical size of the buckets subsurface buffers are rounded up to
+#define BUFFER_SIZE_BUCKET 32
+
+// Rounds the buffer size up to a bucket and to the largest size used so far
+// at this scale, so that text changes keep reusing the same buffers. Buckets
+// are multiples of the scale, as required by the protocol.
+static void apply_buffer_size_class(struct buffer_size_class *size_class,
+									int32_t scale, int *buffer_width, int *buffer_height)
+{
+	if (size_class->scale != scale)
+	{
+		size_class->scale = scale;
+		size_class->width = 0;
+		size_class->height = 0;
+	}
+
+	int bucket = BUFFER_SIZE_BUCKET * scale;
+	int width = (*buffer_width + bucket - 1) / bucket * bucket;
+	int height = (*buffer_height + bucket - 1) / bucket * bucket;
+	if (width > size_class->width)
+	{
+		size_class->width = width;
+	}
+	if (height > size_class->height)
+	{
+		size_class->height = height;
+	}
+	*buffer_width = size_class->width;
+	*buffer_height = size_class->height;
+}
+
+static uint32_t hash_update(uint32_t hash, const void *data, size_t len)
+{
+	// FNV-1a
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static uint32_t hash_string(uint32_t hash, const char *str)
+{
+	// Hash the terminator too, so that NULL and "" differ from other strings
+	return str ? hash_update(hash, str, strlen(str) + 1) : hash_update(hash, "\xff", 1);
+}
+
+// Bounding box of an arc stroked with the given line width
+static struct damage_rect arc_damage(double xc, double yc, double radius,
+									 double angle1, double angle2, double line_width)
+{
+	double min_x = fmin(cos(angle1), cos(angle2));
+	double max_x = fmax(cos(angle1), cos(angle2));
+	double min_y = fmin(sin(angle1), sin(angle2));
+	double max_y = fmax(sin(angle1), sin(angle2));
+	// Extremes are reached wherever the arc crosses an axis
+	for (double a = ceil(angle1 / (M_PI / 2)) * (M_PI / 2); a < angle2; a += M_PI / 2)
+	{
+		min_x = fmin(min_x, cos(a));
+		max_x = fmax(max_x, cos(a));
+		min_y = fmin(min_y, sin(a));
+		max_y = fmax(max_y, sin(a));
+	}
+
+	// One extra pixel for antialiasing
+	double pad = line_width / 2 + 1;
+	struct damage_rect rect;
+	rect.x = floor(xc + radius * min_x - pad);
+	rect.y = floor(yc + radius * min_y - pad);
+	rect.width = ceil(xc + radius * max_x + pad) - rect.x;
+	rect.height = ceil(yc + radius * max_y + pad) - rect.y;
+	return rect;
+}
+
+static void damage_rect(struct wl_surface *surface, const struct damage_rect *rect)
+{
+	if (rect->width > 0 && rect->height > 0)
+	{
+		wl_surface_damage_buffer(surface, rect->x, rect->y, rect->width, rect->height);
 	}
-	cairo_font_options_destroy(fo);
 }
 
 static bool render_fingerprint_status(struct swaylock_surface *surface)
@@ -173,29 +853,23 @@ static bool render_fingerprint_status(struct swaylock_surface *surface)
 
 	// Compute the size of the buffer needed
 	int arch_radius = state->args.radius * surface->scale;
-	int buffer_width = 10;
-	int buffer_height = 10;
-	cairo_set_antialias(state->test_cairo, CAIRO_ANTIALIAS_BEST);
-	configure_font_drawing(state->test_cairo, state, surface->subpixel, arch_radius);
-
-	cairo_text_extents_t extents;
-	cairo_text_extents(state->test_cairo, status, &extents);
-	buffer_width = extents.width;
-	buffer_height = extents.height;
+	struct font *font = get_font(state, surface->subpixel, arch_radius);
+	const struct text_run *run = get_text_run(font, status);
+	int buffer_width = run->extents.width;
+	int buffer_height = run->extents.height;
 
 	int padding = buffer_height / 4;
 
 	buffer_width += 2 * padding;
 	buffer_height += 2 * padding;
 
-	// Ensure buffer size is multiple of buffer scale - required by protocol
-	buffer_width += surface->scale - (buffer_width % surface->scale);
-	buffer_height += surface->scale - (buffer_height % surface->scale);
+	apply_buffer_size_class(&surface->fingerprint_status_size, surface->scale,
+							&buffer_width, &buffer_height);
 
 	int subsurf_xpos = SCREEN_PADDING;
 	int subsurf_ypos = surface->height - buffer_height - SCREEN_PADDING;
 
-	struct pool_buffer *buffer = get_next_buffer(state->shm,
+	struct pool_buffer *buffer = get_next_buffer(state->shm, &surface->shm_pool,
 												 surface->fingerprint_status_buffer, buffer_width, buffer_height);
 
 	if (buffer == NULL)
@@ -205,13 +879,20 @@ static bool render_fingerprint_status(struct swaylock_surface *surface)
 	}
 
 	// Render the buffer
+	uint64_t draw_start = stats_now();
 	cairo_t *cairo = buffer->cairo;
-	// fill the buffer with red to debug
 	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
-	configure_font_drawing(cairo, state, surface->subpixel, arch_radius);
-	cairo_move_to(cairo, padding, buffer_height - padding);
+
+	// Buffers are reused, clear the previous message
+	cairo_save(cairo);
+	cairo_set_source_rgba(cairo, 0, 0, 0, 0);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cairo);
+	cairo_restore(cairo);
+
 	cairo_set_source_rgb(cairo, 0.7, 0.7, 0.7);
-	cairo_show_text(cairo, status);
+	show_text_run(cairo, font, run, padding, buffer_height - padding);
+	stats_record(STATS_DRAW_FINGERPRINT, draw_start);
 
 	// Send Wayland requests
 	wl_subsurface_set_position(surface->fingerprint_subsurface, subsurf_xpos, subsurf_ypos);
@@ -223,6 +904,155 @@ static bool render_fingerprint_status(struct swaylock_surface *surface)
 
 	return true;
 }
+// Where the parts of the indicator go in its buffer, as computed by
+// render_frame
+struct indicator_layout
+{
+	bool draw_indicator;
+	int arc_radius, arc_thickness;
+	int buffer_diameter, buffer_width;
+	struct font *font;
+	const struct text_run *text_run;
+	const struct text_run *layout_run;
+};
+
+// Draws the indicator into any cairo context the size of the indicator
+// buffer, without touching Wayland objects
+static void draw_indicator_layout(cairo_t *cairo, struct swaylock_state *state,
+								  int scale, const struct indicator_layout *layout)
+{
+	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
+	cairo_identity_matrix(cairo);
+
+	// Clear
+	cairo_save(cairo);
+	cairo_set_source_rgba(cairo, 0, 0, 0, 0);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cairo);
+	cairo_restore(cairo);
+
+	int arc_radius = layout->arc_radius;
+	int arc_thickness = layout->arc_thickness;
+	int buffer_width = layout->buffer_width;
+	int buffer_diameter = layout->buffer_diameter;
+	float type_indicator_border_thickness =
+		TYPE_INDICATOR_BORDER_THICKNESS * scale;
+
+	if (layout->draw_indicator)
+	{
+		// The static part of the indicator is rasterized once per state
+		cairo_surface_t *ring_layer = get_ring_layer(state, arc_radius,
+													 arc_thickness, scale);
+		if (ring_layer)
+		{
+			cairo_save(cairo);
+			cairo_set_source_surface(cairo, ring_layer,
+									 buffer_width / 2 - buffer_diameter / 2, 0);
+			cairo_paint(cairo);
+			cairo_restore(cairo);
+		}
+
+		// Draw a message
+		set_color_for_state(cairo, state, &state->args.colors.text);
+
+		if (layout->text_run)
+		{
+			const cairo_text_extents_t *extents = &layout->text_run->extents;
+			const cairo_font_extents_t *fe = &layout->font->extents;
+			double x, y;
+			x = (buffer_width / 2) -
+				(extents->width / 2 + extents->x_bearing);
+			y = (buffer_diameter / 2) +
+				(fe->height / 2 - fe->descent);
+
+			show_text_run(cairo, layout->font, layout->text_run, x, y);
+		}
+
+		// Typing indicator: Highlight random part on keypress
+		if (state->input_state == INPUT_STATE_LETTER ||
+			state->input_state == INPUT_STATE_BACKSPACE)
+		{
+			double highlight_start = state->highlight_start * (M_PI / 1024.0);
+			cairo_set_line_width(cairo, arc_thickness);
+			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
+					  arc_radius, highlight_start,
+					  highlight_start + TYPE_INDICATOR_RANGE);
+			if (state->input_state == INPUT_STATE_LETTER)
+			{
+				if (state->xkb.caps_lock && state->args.show_caps_lock_indicator)
+				{
+					cairo_set_source_u32(cairo, state->args.colors.caps_lock_key_highlight);
+				}
+				else
+				{
+					cairo_set_source_u32(cairo, state->args.colors.key_highlight);
+				}
+			}
+			else
+			{
+				if (state->xkb.caps_lock && state->args.show_caps_lock_indicator)
+				{
+					cairo_set_source_u32(cairo, state->args.colors.caps_lock_bs_highlight);
+				}
+				else
+				{
+					cairo_set_source_u32(cairo, state->args.colors.bs_highlight);
+				}
+			}
+			cairo_stroke(cairo);
+
+			// Draw borders
+			cairo_set_source_u32(cairo, state->args.colors.separator);
+			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
+					  arc_radius, highlight_start,
+					  highlight_start + type_indicator_border_thickness);
+			cairo_stroke(cairo);
+
+			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
+					  arc_radius, highlight_start + TYPE_INDICATOR_RANGE,
+					  highlight_start + TYPE_INDICATOR_RANGE +
+						  type_indicator_border_thickness);
+			cairo_stroke(cairo);
+
+			// The ring borders stay above the highlight
+			set_color_for_state(cairo, state, &state->args.colors.line);
+			cairo_set_line_width(cairo, 2.0 * scale);
+			draw_ring_borders(cairo, buffer_width / 2, buffer_diameter / 2,
+							  arc_radius, arc_thickness, highlight_start,
+							  highlight_start + TYPE_INDICATOR_RANGE +
+								  type_indicator_border_thickness);
+		}
+
+		// display layout text separately
+		if (layout->layout_run)
+		{
+			const cairo_text_extents_t *extents = &layout->layout_run->extents;
+			const cairo_font_extents_t *fe = &layout->font->extents;
+			double x, y;
+			double box_padding = 4.0 * scale;
+			// upper left coordinates for box
+			x = (buffer_width / 2) - (extents->width / 2) - box_padding;
+			y = buffer_diameter;
+
+			// background box
+			cairo_rectangle(cairo, x, y,
+							extents->width + 2.0 * box_padding,
+							fe->height + 2.0 * box_padding);
+			cairo_set_source_u32(cairo, state->args.colors.layout_background);
+			cairo_fill_preserve(cairo);
+			// border
+			cairo_set_source_u32(cairo, state->args.colors.layout_border);
+			cairo_stroke(cairo);
+
+			// take font extents and padding into account
+			cairo_set_source_u32(cairo, state->args.colors.layout_text);
+			show_text_run(cairo, layout->font, layout->layout_run,
+						  x - extents->x_bearing + box_padding,
+						  y + (fe->height - fe->descent) + box_padding);
+		}
+	}
+}
+
 static bool render_frame(struct swaylock_surface *surface)
 {
 	struct swaylock_state *state = surface->state;
@@ -256,7 +1086,7 @@ static bool render_frame(struct swaylock_surface *surface)
 		}
 		else if (state->auth_state == AUTH_STATE_INVALID)
 		{
-			text = "Wrong";
+			text = state->auth_error[0] ? state->auth_error : "Wrong";
 		}
 		else
 		{
@@ -305,37 +1135,34 @@ static bool render_frame(struct swaylock_surface *surface)
 	int buffer_width = buffer_diameter;
 	int buffer_height = buffer_diameter;
 
+	struct font *font = NULL;
+	const struct text_run *text_run = NULL;
+	const struct text_run *layout_run = NULL;
 	if (text || layout_text)
 	{
-		cairo_set_antialias(state->test_cairo, CAIRO_ANTIALIAS_BEST);
-		configure_font_drawing(state->test_cairo, state, surface->subpixel, arc_radius);
+		font = get_font(state, surface->subpixel, arc_radius);
 
 		if (text)
 		{
-			cairo_text_extents_t extents;
-			cairo_text_extents(state->test_cairo, text, &extents);
-			if (buffer_width < extents.width)
+			text_run = get_text_run(font, text);
+			if (buffer_width < text_run->extents.width)
 			{
-				buffer_width = extents.width;
+				buffer_width = text_run->extents.width;
 			}
 		}
 		if (layout_text)
 		{
-			cairo_text_extents_t extents;
-			cairo_font_extents_t fe;
+			layout_run = get_text_run(font, layout_text);
 			double box_padding = 4.0 * surface->scale;
-			cairo_text_extents(state->test_cairo, layout_text, &extents);
-			cairo_font_extents(state->test_cairo, &fe);
-			buffer_height += fe.height + 2 * box_padding;
-			if (buffer_width < extents.width + 2 * box_padding)
+			buffer_height += font->extents.height + 2 * box_padding;
+			if (buffer_width < layout_run->extents.width + 2 * box_padding)
 			{
-				buffer_width = extents.width + 2 * box_padding;
+				buffer_width = layout_run->extents.width + 2 * box_padding;
 			}
 		}
 	}
-	// Ensure buffer size is multiple of buffer scale - required by protocol
-	buffer_height += surface->scale - (buffer_height % surface->scale);
-	buffer_width += surface->scale - (buffer_width % surface->scale);
+	apply_buffer_size_class(&surface->indicator_size, surface->scale,
+							&buffer_width, &buffer_height);
 
 	int subsurf_xpos;
 	int subsurf_ypos;
@@ -363,7 +1190,7 @@ static bool render_frame(struct swaylock_surface *surface)
 					   (state->args.radius + state->args.thickness);
 	}
 
-	struct pool_buffer *buffer = get_next_buffer(state->shm,
+	struct pool_buffer *buffer = get_next_buffer(state->shm, &surface->shm_pool,
 												 surface->indicator_buffers, buffer_width, buffer_height);
 	if (buffer == NULL)
 	{
@@ -372,147 +1199,46 @@ static bool render_frame(struct swaylock_surface *surface)
 	}
 
 	// Render the buffer
-	cairo_t *cairo = buffer->cairo;
-	cairo_set_antialias(cairo, CAIRO_ANTIALIAS_BEST);
-
-	cairo_identity_matrix(cairo);
-
-	// Clear
-	cairo_save(cairo);
-	cairo_set_source_rgba(cairo, 0, 0, 0, 0);
-	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(cairo);
-	cairo_restore(cairo);
+	struct indicator_layout layout = {
+		.draw_indicator = draw_indicator,
+		.arc_radius = arc_radius,
+		.arc_thickness = arc_thickness,
+		.buffer_diameter = buffer_diameter,
+		.buffer_width = buffer_width,
+		.font = font,
+		.text_run = text_run,
+		.layout_run = layout_run,
+	};
+	uint64_t draw_start = stats_now();
+	draw_indicator_layout(buffer->cairo, state, surface->scale, &layout);
+	stats_record(STATS_DRAW_INDICATOR, draw_start);
 
 	float type_indicator_border_thickness =
 		TYPE_INDICATOR_BORDER_THICKNESS * surface->scale;
 
-	if (draw_indicator)
+	// Keypresses only move the highlight, everything else invalidates the
+	// whole indicator
+	bool highlight = draw_indicator &&
+					 (state->input_state == INPUT_STATE_LETTER ||
+					  state->input_state == INPUT_STATE_BACKSPACE);
+	uint32_t signature = 2166136261u;
+	int indicator_state[] = {
+		draw_indicator, highlight, state->auth_state,
+		state->input_state == INPUT_STATE_CLEAR, state->xkb.caps_lock,
+		buffer_width, buffer_height, subsurf_xpos, subsurf_ypos,
+		surface->scale, surface->subpixel};
+	signature = hash_update(signature, indicator_state, sizeof(indicator_state));
+	signature = hash_string(signature, text);
+	signature = hash_string(signature, layout_text);
+
+	struct damage_rect highlight_rect = {0};
+	if (highlight)
 	{
-		// Fill inner circle
-		cairo_set_line_width(cairo, 0);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-				  arc_radius - arc_thickness / 2, 0, 2 * M_PI);
-		set_color_for_state(cairo, state, &state->args.colors.inside);
-		cairo_fill_preserve(cairo);
-		cairo_stroke(cairo);
-
-		// Draw ring
-		cairo_set_line_width(cairo, arc_thickness);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2, arc_radius,
-				  0, 2 * M_PI);
-		set_color_for_state(cairo, state, &state->args.colors.ring);
-		cairo_stroke(cairo);
-
-		// Draw a message
-		configure_font_drawing(cairo, state, surface->subpixel, arc_radius);
-		set_color_for_state(cairo, state, &state->args.colors.text);
-
-		if (text)
-		{
-			cairo_text_extents_t extents;
-			cairo_font_extents_t fe;
-			double x, y;
-			cairo_text_extents(cairo, text, &extents);
-			cairo_font_extents(cairo, &fe);
-			x = (buffer_width / 2) -
-				(extents.width / 2 + extents.x_bearing);
-			y = (buffer_diameter / 2) +
-				(fe.height / 2 - fe.descent);
-
-			cairo_move_to(cairo, x, y);
-			cairo_show_text(cairo, text);
-			cairo_close_path(cairo);
-			cairo_new_sub_path(cairo);
-		}
-
-		// Typing indicator: Highlight random part on keypress
-		if (state->input_state == INPUT_STATE_LETTER ||
-			state->input_state == INPUT_STATE_BACKSPACE)
-		{
-			double highlight_start = state->highlight_start * (M_PI / 1024.0);
-			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-					  arc_radius, highlight_start,
-					  highlight_start + TYPE_INDICATOR_RANGE);
-			if (state->input_state == INPUT_STATE_LETTER)
-			{
-				if (state->xkb.caps_lock && state->args.show_caps_lock_indicator)
-				{
-					cairo_set_source_u32(cairo, state->args.colors.caps_lock_key_highlight);
-				}
-				else
-				{
-					cairo_set_source_u32(cairo, state->args.colors.key_highlight);
-				}
-			}
-			else
-			{
-				if (state->xkb.caps_lock && state->args.show_caps_lock_indicator)
-				{
-					cairo_set_source_u32(cairo, state->args.colors.caps_lock_bs_highlight);
-				}
-				else
-				{
-					cairo_set_source_u32(cairo, state->args.colors.bs_highlight);
-				}
-			}
-			cairo_stroke(cairo);
-
-			// Draw borders
-			cairo_set_source_u32(cairo, state->args.colors.separator);
-			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-					  arc_radius, highlight_start,
-					  highlight_start + type_indicator_border_thickness);
-			cairo_stroke(cairo);
-
-			cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-					  arc_radius, highlight_start + TYPE_INDICATOR_RANGE,
-					  highlight_start + TYPE_INDICATOR_RANGE +
-						  type_indicator_border_thickness);
-			cairo_stroke(cairo);
-		}
-
-		// Draw inner + outer border of the circle
-		set_color_for_state(cairo, state, &state->args.colors.line);
-		cairo_set_line_width(cairo, 2.0 * surface->scale);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-				  arc_radius - arc_thickness / 2, 0, 2 * M_PI);
-		cairo_stroke(cairo);
-		cairo_arc(cairo, buffer_width / 2, buffer_diameter / 2,
-				  arc_radius + arc_thickness / 2, 0, 2 * M_PI);
-		cairo_stroke(cairo);
-
-		// display layout text separately
-		if (layout_text)
-		{
-			cairo_text_extents_t extents;
-			cairo_font_extents_t fe;
-			double x, y;
-			double box_padding = 4.0 * surface->scale;
-			cairo_text_extents(cairo, layout_text, &extents);
-			cairo_font_extents(cairo, &fe);
-			// upper left coordinates for box
-			x = (buffer_width / 2) - (extents.width / 2) - box_padding;
-			y = buffer_diameter;
-
-			// background box
-			cairo_rectangle(cairo, x, y,
-							extents.width + 2.0 * box_padding,
-							fe.height + 2.0 * box_padding);
-			cairo_set_source_u32(cairo, state->args.colors.layout_background);
-			cairo_fill_preserve(cairo);
-			// border
-			cairo_set_source_u32(cairo, state->args.colors.layout_border);
-			cairo_stroke(cairo);
-
-			// take font extents and padding into account
-			cairo_move_to(cairo,
-						  x - extents.x_bearing + box_padding,
-						  y + (fe.height - fe.descent) + box_padding);
-			cairo_set_source_u32(cairo, state->args.colors.layout_text);
-			cairo_show_text(cairo, layout_text);
-			cairo_new_sub_path(cairo);
-		}
+		double highlight_start = state->highlight_start * (M_PI / 1024.0);
+		highlight_rect = arc_damage(buffer_width / 2, buffer_diameter / 2, arc_radius,
+									highlight_start,
+									highlight_start + TYPE_INDICATOR_RANGE + type_indicator_border_thickness,
+									arc_thickness + 2.0 * surface->scale);
 	}
 
 	// Send Wayland requests
@@ -520,7 +1246,17 @@ static bool render_frame(struct swaylock_surface *surface)
 
 	wl_surface_set_buffer_scale(surface->child, surface->scale);
 	wl_surface_attach(surface->child, buffer->buffer, 0, 0);
-	wl_surface_damage_buffer(surface->child, 0, 0, INT32_MAX, INT32_MAX);
+	if (signature == surface->indicator_signature)
+	{
+		damage_rect(surface->child, &surface->indicator_highlight);
+		damage_rect(surface->child, &highlight_rect);
+	}
+	else
+	{
+		wl_surface_damage_buffer(surface->child, 0, 0, INT32_MAX, INT32_MAX);
+	}
+	surface->indicator_signature = signature;
+	surface->indicator_highlight = highlight_rect;
 	wl_surface_commit(surface->child);
 
 	return true;
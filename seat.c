@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
@@ -7,6 +9,67 @@
 #include "swaylock.h"
 #include "seat.h"
 #include "loop.h"
+#include "stats.h"
+
+// Compiled keymaps by content, since every keyboard of every seat sends its
+// keymap again on hotplug and usually the same one
+struct keymap_cache_entry {
+	uint64_t hash;
+	size_t size;
+	char *text;
+	struct xkb_keymap *keymap;
+	uint64_t last_used;
+};
+
+static struct keymap_cache_entry keymap_cache[4];
+static uint64_t keymap_cache_clock = 0;
+
+static uint64_t hash_keymap(const char *text, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ (unsigned char)text[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+// Returns a new reference to the keymap compiled from text
+static struct xkb_keymap *get_keymap(struct xkb_context *context,
+		const char *text, size_t size) {
+	uint64_t hash = hash_keymap(text, size);
+	struct keymap_cache_entry *slot = &keymap_cache[0];
+	for (size_t i = 0; i < sizeof(keymap_cache) / sizeof(keymap_cache[0]); ++i) {
+		struct keymap_cache_entry *entry = &keymap_cache[i];
+		if (entry->keymap && entry->hash == hash && entry->size == size &&
+				memcmp(entry->text, text, size) == 0) {
+			entry->last_used = ++keymap_cache_clock;
+			return xkb_keymap_ref(entry->keymap);
+		}
+		if (!entry->keymap || (slot->keymap &&
+				entry->last_used < slot->last_used)) {
+			slot = entry;
+		}
+	}
+
+	struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(context, text, size,
+		XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	if (!keymap) {
+		return NULL;
+	}
+	char *copy = malloc(size);
+	if (!copy) {
+		return keymap;
+	}
+	memcpy(copy, text, size);
+
+	free(slot->text);
+	xkb_keymap_unref(slot->keymap);
+	slot->hash = hash;
+	slot->size = size;
+	slot->text = copy;
+	slot->keymap = keymap;
+	slot->last_used = ++keymap_cache_clock;
+	return xkb_keymap_ref(keymap);
+}
 
 static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
 		uint32_t format, int32_t fd, uint32_t size) {
@@ -23,12 +86,16 @@ static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
 		swaylock_log(LOG_ERROR, "Unable to initialize keymap shm, aborting");
 		exit(1);
 	}
-	struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(
-			state->xkb.context, map_shm, size - 1, XKB_KEYMAP_FORMAT_TEXT_V1,
-			XKB_KEYMAP_COMPILE_NO_FLAGS);
+	struct xkb_keymap *keymap =
+		get_keymap(state->xkb.context, map_shm, size - 1);
 	munmap(map_shm, size - 1);
 	close(fd);
 	assert(keymap);
+	if (keymap == state->xkb.keymap) {
+		// Keep the state, and with it the current modifiers
+		xkb_keymap_unref(keymap);
+		return;
+	}
 	struct xkb_state *xkb_state = xkb_state_new(keymap);
 	assert(xkb_state);
 	xkb_keymap_unref(state->xkb.keymap);
@@ -49,10 +116,7 @@ static void keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
 
 static void keyboard_repeat(void *data) {
 	struct swaylock_seat *seat = data;
-	struct swaylock_state *state = seat->state;
-	seat->repeat_timer = loop_add_timer(
-		state->eventloop, seat->repeat_period_ms, keyboard_repeat, seat);
-	swaylock_handle_key(state, seat->repeat_sym, seat->repeat_codepoint);
+	swaylock_handle_key(seat->state, seat->repeat_sym, seat->repeat_codepoint);
 }
 
 static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
@@ -65,19 +129,23 @@ static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
 		key + 8 : 0;
 	uint32_t codepoint = xkb_state_key_get_utf32(state->xkb.state, keycode);
 	if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED) {
+		stats_key();
 		swaylock_handle_key(state, sym, codepoint);
 	}
 
-	if (seat->repeat_timer) {
-		loop_remove_timer(seat->state->eventloop, seat->repeat_timer);
-		seat->repeat_timer = NULL;
-	}
-
 	if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED && seat->repeat_period_ms > 0) {
-		seat->repeat_sym = sym;
-		seat->repeat_codepoint = codepoint;
-		seat->repeat_timer = loop_add_timer(
-			seat->state->eventloop, seat->repeat_delay_ms, keyboard_repeat, seat);
+		if (!seat->repeat_timer) {
+			seat->repeat_timer = loop_timer_create(state->eventloop,
+				keyboard_repeat, seat);
+		}
+		if (seat->repeat_timer) {
+			seat->repeat_sym = sym;
+			seat->repeat_codepoint = codepoint;
+			loop_timer_arm(state->eventloop, seat->repeat_timer,
+				seat->repeat_delay_ms, seat->repeat_period_ms);
+		}
+	} else if (seat->repeat_timer) {
+		loop_timer_disarm(state->eventloop, seat->repeat_timer);
 	}
 }
 
@@ -197,6 +265,9 @@ static void seat_handle_capabilities(void *data, struct wl_seat *wl_seat,
 		wl_keyboard_release(seat->keyboard);
 		seat->keyboard = NULL;
 	}
+	// Created again by the next key press, if the keyboard comes back
+	loop_timer_destroy(seat->state->eventloop, seat->repeat_timer);
+	seat->repeat_timer = NULL;
 	if ((caps & WL_SEAT_CAPABILITY_POINTER)) {
 		seat->pointer = wl_seat_get_pointer(wl_seat);
 		wl_pointer_add_listener(seat->pointer, &pointer_listener, NULL);
@@ -216,3 +287,17 @@ const struct wl_seat_listener seat_listener = {
 	.capabilities = seat_handle_capabilities,
 	.name = seat_handle_name,
 };
+
+void swaylock_seat_destroy(struct swaylock_seat *seat) {
+	if (seat->pointer) {
+		wl_pointer_release(seat->pointer);
+	}
+	if (seat->keyboard) {
+		wl_keyboard_release(seat->keyboard);
+	}
+	loop_timer_destroy(seat->state->eventloop, seat->repeat_timer);
+	seat->repeat_timer = NULL;
+	wl_seat_destroy(seat->wl_seat);
+	wl_list_remove(&seat->link);
+	free(seat);
+}
@@ -51,7 +51,7 @@ void initialize_pw_backend(int argc, char **argv) {
 	/* This code does not run as root */
 	swaylock_log(LOG_DEBUG, "Prepared to authorize user %s", pwent->pw_name);
 
-	if (!spawn_comm_child()) {
+	if (!spawn_comm_child(run_pw_backend_child)) {
 		exit(EXIT_FAILURE);
 	}
 
@@ -60,11 +60,16 @@ void initialize_pw_backend(int argc, char **argv) {
 	encpw = NULL;
 }
 
+void start_pw_backend(const struct swaylock_args *args) {
+	// Forked by initialize_pw_backend, so that the hash is not kept around
+}
+
 void run_pw_backend_child(void) {
 	assert(encpw != NULL);
 	while (1) {
 		char *buf;
-		ssize_t size = read_comm_request(&buf);
+		uint32_t id;
+		ssize_t size = read_comm_request(&id, &buf);
 		if (size < 0) {
 			exit(EXIT_FAILURE);
 		} else if (size == 0) {
@@ -81,11 +86,14 @@ void run_pw_backend_child(void) {
 		}
 		bool success = strcmp(c, encpw) == 0;
 
-		if (!write_comm_reply(success)) {
+		if (!write_comm_reply(id, success ? COMM_STATUS_SUCCESS :
+				COMM_STATUS_FAILURE, success ? 0 : 2000, NULL)) {
 			exit(EXIT_FAILURE);
 		}
 
-		sleep(2);
+		if (!success) {
+			sleep(2);
+		}
 	}
 
 	clear_buffer(encpw, strlen(encpw));
@@ -0,0 +1,131 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+#include "config.h"
+#include "stats.h"
+#if HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+// Values below STATS_SUB_BUCKETS ns get a bucket each, larger ones get
+// STATS_SUB_BUCKETS buckets per power of two, which is within 7%
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+struct stats_histogram_data {
+	uint32_t buckets[STATS_BUCKETS];
+	uint64_t count;
+	uint64_t max;
+};
+
+static const char *histogram_names[] = {
+	[STATS_RENDER] = "render",
+	[STATS_DRAW_BACKGROUND] = "draw-background",
+	[STATS_DRAW_INDICATOR] = "draw-indicator",
+	[STATS_DRAW_FINGERPRINT] = "draw-fingerprint",
+	[STATS_KEY_TO_COMMIT] = "key-to-commit",
+	[STATS_KEY_TO_FRAME] = "key-to-frame",
+	[STATS_AUTH] = "auth",
+	[STATS_FINGERPRINT_START] = "fingerprint-start",
+	[STATS_FINGERPRINT_STATUS] = "fingerprint-status",
+};
+
+static bool stats_enabled = false;
+static struct stats_histogram_data histograms[STATS_HISTOGRAM_COUNT];
+static uint64_t pending_key = 0;
+
+static size_t bucket_index(uint64_t value) {
+	if (value < STATS_SUB_BUCKETS) {
+		return value;
+	}
+	int exp = 63 - __builtin_clzll(value);
+	return (exp - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS +
+		((value >> (exp - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+// Returns the middle of the values counted in a bucket
+static double bucket_value(size_t index) {
+	if (index < STATS_SUB_BUCKETS) {
+		return index;
+	}
+	int shift = index / STATS_SUB_BUCKETS - 1;
+	uint64_t low = (uint64_t)(STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS)
+		<< shift;
+	return low + ((1ull << shift) - 1) / 2.0;
+}
+
+static double percentile(const struct stats_histogram_data *data, double p) {
+	uint64_t rank = (uint64_t)(p * data->count);
+	if (rank >= data->count) {
+		rank = data->count - 1;
+	}
+	uint64_t seen = 0;
+	for (size_t i = 0; i < STATS_BUCKETS; ++i) {
+		seen += data->buckets[i];
+		if (seen > rank) {
+			return bucket_value(i);
+		}
+	}
+	return data->max;
+}
+
+void stats_init(bool enabled) {
+	stats_enabled = enabled;
+}
+
+uint64_t stats_now(void) {
+	if (!stats_enabled) {
+		return 0;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void stats_record(enum stats_histogram histogram, uint64_t start) {
+	if (start == 0) {
+		return;
+	}
+	uint64_t now = stats_now();
+	uint64_t value = now > start ? now - start : 0;
+#if HAVE_SYS_SDT_H
+	DTRACE_PROBE2(swaylock, sample, (int)histogram, value);
+#endif
+	struct stats_histogram_data *data = &histograms[histogram];
+	++data->buckets[bucket_index(value)];
+	++data->count;
+	if (value > data->max) {
+		data->max = value;
+	}
+}
+
+void stats_key(void) {
+	if (pending_key == 0) {
+		pending_key = stats_now();
+	}
+}
+
+uint64_t stats_commit(void) {
+	uint64_t key = pending_key;
+	stats_record(STATS_KEY_TO_COMMIT, key);
+	pending_key = 0;
+	return key;
+}
+
+void stats_dump(void) {
+	if (!stats_enabled) {
+		return;
+	}
+	for (int i = 0; i < STATS_HISTOGRAM_COUNT; ++i) {
+		const struct stats_histogram_data *data = &histograms[i];
+		if (data->count == 0) {
+			continue;
+		}
+		fprintf(stderr, "stats: %-18s n=%-6llu p50=%.3fms p90=%.3fms "
+			"p99=%.3fms max=%.3fms\n", histogram_names[i],
+			(unsigned long long)data->count, percentile(data, 0.5) / 1e6,
+			percentile(data, 0.9) / 1e6, percentile(data, 0.99) / 1e6,
+			data->max / 1e6);
+	}
+}